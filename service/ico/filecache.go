@@ -3,28 +3,62 @@ package ico
 import (
 	// Standard library
 	"container/list"
+	"hash/fnv"
 	"io/ioutil"
 	"os"
 	"path"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
 	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
 )
 
-// FileCache implements a simple filesystem-based cache for arbitrary data.
+// The number of independent shards each cache is split into. Keys are hashed onto shards, so
+// concurrent operations on distinct keys rarely contend on the same lock.
+const cacheShards = 16
+
+// FileCache implements a simple filesystem-based cache for arbitrary data. Internal book-keeping
+// is split across independently-locked shards, with usage accounting done atomically across them.
 type FileCache struct {
 	path  string // The path to the directory in which to place cached files.
 	quota int64  // The disk quota size, in bytes. A value of zero means no limit.
-	usage int64  // The current disk usage, in bytes.
+	usage int64  // The current disk usage, in bytes. Accessed atomically.
+	next  uint32 // The next shard to evict from, used for round-robin eviction. Accessed atomically.
+
+	hits      uint64 // The number of lookups answered from the cache. Accessed atomically.
+	misses    uint64 // The number of lookups for files not in the cache. Accessed atomically.
+	evictions uint64 // The number of files evicted to stay within quota. Accessed atomically.
+
+	shards [cacheShards]*cacheShard // Independent shards, each holding a portion of the key space.
+}
 
+// A cacheShard holds the item list and lookup table for a portion of the cache's key space, along
+// with a lock controlling concurrent access to both.
+type cacheShard struct {
 	order *list.List               // A doubly-linked list of items, ordered by access time.
 	cache map[string]*list.Element // A reverse lookup table of item names to list elements.
 
-	sync.RWMutex // Used for controlling concurrent access to item list and cache table.
+	sync.Mutex // Used for controlling concurrent access to item list and cache table.
 }
 
 // A file represents all information required for operating on a file in the context of the cache.
+// The content hash is computed on insertion, and lazily for files restored from a previous run.
 type file struct {
 	size int64
 	key  string
+	hash string
+}
+
+// Returns a hexadecimal content hash for the data provided, suitable for use as an HTTP entity tag.
+func hashData(data []byte) string {
+	h := fnv.New64a()
+	h.Write(data)
+
+	return strconv.FormatUint(h.Sum64(), 16)
 }
 
 // A map of initialized caches, indexed under their path names. This is checked against every time
@@ -45,32 +79,105 @@ func NewFileCache(name string, quota int64) (*FileCache, error) {
 		return f, nil
 	}
 
-	// Remove directory structure first, if any.
-	if err := os.RemoveAll(name); err != nil {
-		return nil, err
-	}
-
 	// Create directory structure for cached files.
 	if err := os.MkdirAll(name, 0755); err != nil {
 		return nil, err
 	}
 
-	caches[name] = &FileCache{
-		path:  name,
-		quota: quota,
-		order: list.New(),
-		cache: make(map[string]*list.Element),
+	f := &FileCache{path: name, quota: quota}
+	for i := range f.shards {
+		f.shards[i] = &cacheShard{
+			order: list.New(),
+			cache: make(map[string]*list.Element),
+		}
+	}
+
+	// Re-index any files left over from a previous run, so restarts begin with a warm cache. A
+	// cache directory that cannot be scanned is assumed corrupt, and is wiped and started cold.
+	if err := f.restore(); err != nil {
+		if err := os.RemoveAll(name); err != nil {
+			return nil, err
+		}
+
+		if err := os.MkdirAll(name, 0755); err != nil {
+			return nil, err
+		}
 	}
 
+	caches[name] = f
 	return caches[name], nil
 }
 
+// Returns the shard responsible for the key provided.
+func (f *FileCache) shard(key string) *cacheShard {
+	h := fnv.New32a()
+	h.Write([]byte(key))
+
+	return f.shards[h.Sum32()%cacheShards]
+}
+
+// Rebuilds internal book-keeping for files already present in the cache directory, using file
+// modification times as an approximation of their original access order. Files are dropped from
+// the end of the rebuilt list if their total size exceeds the cache quota.
+func (f *FileCache) restore() error {
+	type entry struct {
+		key  string
+		size int64
+		used time.Time
+	}
+
+	var found []entry
+
+	err := filepath.Walk(f.path, func(p string, info os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		} else if info.IsDir() {
+			return nil
+		}
+
+		// Remove temporary files left behind by writes interrupted in a previous run.
+		if strings.HasPrefix(info.Name(), ".") {
+			os.Remove(p)
+			return nil
+		}
+
+		found = append(found, entry{
+			key:  strings.TrimPrefix(p, f.path),
+			size: info.Size(),
+			used: info.ModTime(),
+		})
+
+		return nil
+	})
+
+	if err != nil {
+		return err
+	}
+
+	// Insert files oldest-first, leaving the most recently used at the front of each shard list.
+	sort.Slice(found, func(i, j int) bool { return found[i].used.Before(found[j].used) })
+
+	for _, e := range found {
+		s := f.shard(e.key)
+		s.cache[e.key] = s.order.PushFront(&file{size: e.size, key: e.key})
+		atomic.AddInt64(&f.usage, e.size)
+	}
+
+	// Evict oldest files until the restored cache fits within its quota, if any.
+	for f.quota > 0 && atomic.LoadInt64(&f.usage) > f.quota {
+		if !f.RemoveOldest() {
+			break
+		}
+	}
+
+	return nil
+}
+
 // Add inserts in `value` to file pointed to by `key`. Variable `value` is assumed to be a `[]byte`
 // type, but is passed as an `interface{}` type to satisfy the generic `Cacher` interface.
 func (f *FileCache) Add(key string, value interface{}) {
 	var ok bool
 	var data []byte
-	var el *list.Element
 
 	// Refuse to store non-byte-slice data.
 	if data, ok = value.([]byte); !ok {
@@ -82,19 +189,25 @@ func (f *FileCache) Add(key string, value interface{}) {
 		return
 	}
 
-	f.Lock()
-	defer f.Unlock()
+	s := f.shard(key)
+
+	s.Lock()
 
 	// If entry already exists, move to front and return.
-	if el, ok = f.cache[key]; ok {
-		f.order.MoveToFront(el)
+	if el, exists := s.cache[key]; exists {
+		s.order.MoveToFront(el)
+		s.Unlock()
 		return
 	}
 
+	s.Unlock()
+
 	// If writing the file would bring us above quota, remove oldest files as required.
 	// NOTE: If the call to write the data below fails, affected files will STILL be removed.
-	for f.quota > 0 && int64(len(data)) > f.quota {
-		f.RemoveOldest()
+	for f.quota > 0 && atomic.LoadInt64(&f.usage)+int64(len(data)) > f.quota {
+		if !f.RemoveOldest() {
+			break
+		}
 	}
 
 	// Create path heirarchy for file.
@@ -103,74 +216,242 @@ func (f *FileCache) Add(key string, value interface{}) {
 		return
 	}
 
-	// Write file to disk.
-	if err := ioutil.WriteFile(p, data, 0644); err != nil {
+	// Write data to a unique temporary file in the same directory, renaming it into place once
+	// fully written. The write happens outside the shard lock, so concurrent calls for the same
+	// key may race: renames are atomic, so readers only ever observe a complete body, and a file
+	// another request holds open or memory-mapped is replaced rather than truncated under it.
+	tmp, err := ioutil.TempFile(path.Dir(p), "."+path.Base(p)+".")
+	if err != nil {
+		return
+	}
+
+	if err := tmp.Chmod(0644); err != nil {
+		tmp.Close()
+		os.Remove(tmp.Name())
+		return
+	}
+
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		os.Remove(tmp.Name())
+		return
+	}
+
+	if err := tmp.Close(); err != nil {
+		os.Remove(tmp.Name())
 		return
 	}
 
-	// Push file pointer to front of file list.
-	el = f.order.PushFront(&file{
+	if err := os.Rename(tmp.Name(), p); err != nil {
+		os.Remove(tmp.Name())
+		return
+	}
+
+	// Push file pointer to front of shard's file list, re-checking for an entry inserted by a
+	// concurrent call for the same key while the lock was dropped; both will have written the
+	// same file, but only one may account for it.
+	s.Lock()
+	if el, exists := s.cache[key]; exists {
+		s.order.MoveToFront(el)
+		s.Unlock()
+		return
+	}
+
+	s.cache[key] = s.order.PushFront(&file{
 		size: int64(len(data)),
 		key:  key,
+		hash: hashData(data),
 	})
+	s.Unlock()
 
-	f.usage += el.Value.(*file).size
-	f.cache[key] = el
+	atomic.AddInt64(&f.usage, int64(len(data)))
 }
 
 // Get returns data stored under `key`, or `nil` if no data exists.
 func (f *FileCache) Get(key string) interface{} {
 	var data []byte
-	var el *list.Element
 
-	f.RLock()
+	s := f.shard(key)
 
-	// Check reverse lookup table for file entry.
-	if el, _ = f.cache[key]; el == nil {
-		f.RUnlock()
+	// Check reverse lookup table for file entry, moving it to the front of the shard's list while
+	// the lock is held. The file itself is read outside the lock.
+	s.Lock()
+	el, exists := s.cache[key]
+	if exists {
+		s.order.MoveToFront(el)
+	}
+	s.Unlock()
+
+	if !exists {
+		atomic.AddUint64(&f.misses, 1)
 		return nil
 	}
 
-	f.RUnlock()
+	atomic.AddUint64(&f.hits, 1)
 
-	// Read file from disk and move file list entry to the front.
+	// Read file from disk, touching the file's modification time so access order survives
+	// restarts.
 	if data, _ = ioutil.ReadFile(path.Join(f.path, key)); data == nil {
 		return nil
 	}
 
-	// Move element to the front of the list asynchronously.
-	go func() {
-		f.Lock()
-		f.order.MoveToFront(el)
-		f.Unlock()
-	}()
+	now := time.Now()
+	os.Chtimes(path.Join(f.path, key), now, now)
+
+	return data
+}
+
+// Map returns the contents of the file stored under `key` as a read-only memory mapping, or nil
+// if no file exists or it could not be mapped. The mapping is backed by the kernel page cache, so
+// no copy of the data passes through the heap; it must be released with syscall.Munmap once no
+// longer referenced, typically via the owning image's release hook.
+func (f *FileCache) Map(key string) []byte {
+	s := f.shard(key)
+
+	// Check reverse lookup table for file entry, moving it to the front of the shard's list while
+	// the lock is held. The file itself is mapped outside the lock.
+	s.Lock()
+	el, exists := s.cache[key]
+	if exists {
+		s.order.MoveToFront(el)
+	}
+	s.Unlock()
+
+	if !exists {
+		atomic.AddUint64(&f.misses, 1)
+		return nil
+	}
+
+	atomic.AddUint64(&f.hits, 1)
+
+	p := path.Join(f.path, key)
+	fl, err := os.Open(p)
+	if err != nil {
+		return nil
+	}
+
+	defer fl.Close()
+
+	info, err := fl.Stat()
+	if err != nil || info.Size() == 0 {
+		return nil
+	}
+
+	data, err := syscall.Mmap(int(fl.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil
+	}
+
+	// Touch the file's modification time so access order survives restarts.
+	now := time.Now()
+	os.Chtimes(p, now, now)
 
 	return data
 }
 
+// Stat returns the on-disk path and content hash for the file stored under `key`, marking the
+// file as recently used. The boolean returned is false if no file exists under `key`. This allows
+// callers to serve cached files directly from disk, without copying their contents through memory.
+func (f *FileCache) Stat(key string) (string, string, bool) {
+	s := f.shard(key)
+
+	s.Lock()
+	el, exists := s.cache[key]
+	if exists {
+		s.order.MoveToFront(el)
+	}
+	s.Unlock()
+
+	if !exists {
+		atomic.AddUint64(&f.misses, 1)
+		return "", "", false
+	}
+
+	atomic.AddUint64(&f.hits, 1)
+
+	p := path.Join(f.path, key)
+	fl := el.Value.(*file)
+
+	// Compute and memoize the content hash for files restored from a previous run, which are
+	// indexed without one.
+	s.Lock()
+	hash := fl.hash
+	s.Unlock()
+
+	if hash == "" {
+		data, err := ioutil.ReadFile(p)
+		if err != nil {
+			return "", "", false
+		}
+
+		hash = hashData(data)
+
+		s.Lock()
+		fl.hash = hash
+		s.Unlock()
+	}
+
+	return p, hash, true
+}
+
 // Remove removes file stored under `key`.
 func (f *FileCache) Remove(key string) {
-	if el, exists := f.cache[key]; exists {
-		f.removeElement(el)
+	s := f.shard(key)
+
+	s.Lock()
+	el, exists := s.cache[key]
+	if exists {
+		delete(s.cache, key)
+		s.order.Remove(el)
+	}
+	s.Unlock()
+
+	if exists {
+		f.removeFile(el.Value.(*file))
 	}
 }
 
-// RemoveOldest removes the oldest file in cache, as determined by access time.
-func (f *FileCache) RemoveOldest() {
-	if el := f.order.Back(); el != nil {
-		f.removeElement(el)
+// RemoveOldest removes the oldest file in an approximately least-recently-used fashion: shards are
+// visited round-robin, and the oldest file in the visited shard is removed. Returns false if the
+// cache holds no files to remove.
+func (f *FileCache) RemoveOldest() bool {
+	for i := 0; i < cacheShards; i++ {
+		s := f.shards[atomic.AddUint32(&f.next, 1)%cacheShards]
+
+		s.Lock()
+		el := s.order.Back()
+		if el != nil {
+			delete(s.cache, el.Value.(*file).key)
+			s.order.Remove(el)
+		}
+		s.Unlock()
+
+		if el != nil {
+			f.removeFile(el.Value.(*file))
+			atomic.AddUint64(&f.evictions, 1)
+			return true
+		}
 	}
+
+	return false
 }
 
-// Delete file stored on disk as well as any internal state related to file.
-func (f *FileCache) removeElement(el *list.Element) {
-	// Remove file and subtract file size from total usage.
-	os.Remove(path.Join(f.path, el.Value.(*file).key))
-	f.usage -= el.Value.(*file).size
+// Stats returns a point-in-time snapshot of cache usage and hit statistics.
+func (f *FileCache) Stats() map[string]interface{} {
+	return map[string]interface{}{
+		"usage":     atomic.LoadInt64(&f.usage),
+		"quota":     f.quota,
+		"hits":      atomic.LoadUint64(&f.hits),
+		"misses":    atomic.LoadUint64(&f.misses),
+		"evictions": atomic.LoadUint64(&f.evictions),
+	}
+}
 
-	// Remove internal book-keeping entries.
-	delete(f.cache, el.Value.(*file).key)
-	f.order.Remove(el)
+// Delete file stored on disk and subtract its size from total usage. Internal book-keeping is
+// assumed to have been removed by the caller, under the owning shard's lock.
+func (f *FileCache) removeFile(fl *file) {
+	os.Remove(path.Join(f.path, fl.key))
+	atomic.AddInt64(&f.usage, -fl.size)
 }
 
 // Initialize common package variables.
@@ -0,0 +1,91 @@
+package ico
+
+import (
+	// Standard library
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"testing"
+)
+
+// The number of distinct keys and the object size used for cache benchmarks,
+// roughly matching a processed thumbnail.
+const (
+	benchKeys     = 128
+	benchDataSize = 64 << 10 // 64KB
+)
+
+// Prepares a file cache in a temporary directory, pre-populated with the
+// benchmark key set. Callers are expected to remove the returned directory
+// once the benchmark completes.
+func benchFileCache(b *testing.B, quota int64) (*FileCache, []byte, string) {
+	dir, err := ioutil.TempDir("", "mash-ico-bench")
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	c, err := NewFileCache(dir, quota)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	data := bytes.Repeat([]byte{0x42}, benchDataSize)
+	for i := 0; i < benchKeys; i++ {
+		c.Add(fmt.Sprintf("/bench/img-%d", i), data)
+	}
+
+	return c, data, dir
+}
+
+// Benchmarks concurrent reads against a warm cache, which is the dominant
+// operation in steady state.
+func BenchmarkFileCacheGet(b *testing.B) {
+	c, _, dir := benchFileCache(b, 0)
+	defer os.RemoveAll(dir)
+
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			if data := c.Get(fmt.Sprintf("/bench/img-%d", i%benchKeys)); data == nil {
+				b.Fatal("cache miss on warm cache")
+			}
+			i++
+		}
+	})
+}
+
+// Benchmarks concurrent book-keeping lookups against a warm cache, as used
+// when serving cached files directly from disk.
+func BenchmarkFileCacheStat(b *testing.B) {
+	c, _, dir := benchFileCache(b, 0)
+	defer os.RemoveAll(dir)
+
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			if _, _, exists := c.Stat(fmt.Sprintf("/bench/img-%d", i%benchKeys)); !exists {
+				b.Fatal("cache miss on warm cache")
+			}
+			i++
+		}
+	})
+}
+
+// Benchmarks concurrent writes under a quota sized to force eviction, mixing
+// insertion, disk writes and round-robin eviction across shards.
+func BenchmarkFileCacheAdd(b *testing.B) {
+	c, data, dir := benchFileCache(b, benchKeys*benchDataSize/2)
+	defer os.RemoveAll(dir)
+
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			c.Add(fmt.Sprintf("/bench/add-%d", i%benchKeys), data)
+			i++
+		}
+	})
+}
@@ -5,26 +5,128 @@ import (
 	"flag"
 	"fmt"
 	"net/http"
+	"os"
 	"path"
+	"runtime"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
 
 	// Internal packages
 	"github.com/deuill/mash/service"
+	"github.com/deuill/mash/service/ico/image"
 	"github.com/deuill/mash/service/ico/pipeline"
 )
 
 // The Ico service, containing state shared between methods.
 type Ico struct {
 	Quota       *int64  // The image cache size maximum, in bytes.
+	Memory      *int64  // The in-memory cache size maximum, in bytes. Zero disables the memory tier.
+	Concurrency *int64  // The number of threads used for image processing. Zero uses all processors.
+	Workers     *int64  // The number of concurrent image transformations. Zero uses all processors.
+	Queue       *int64  // The number of queued transformations. Zero uses four slots per worker.
 	S3Region    *string // S3 region to use for bucket.
 	S3Bucket    *string // S3 bucket to use for image access.
 	S3AccessKey *string // Access key to use for bucket. If empty, access will be attempted with IAM.
 	S3SecretKey *string // Secret key to use for bucket. If empty, access will be attempted with IAM.
+	S3MaxIdle   *int64  // The number of idle S3 connections kept per host. Zero uses the Go default.
+	S3KeepAlive *int64  // The time idle S3 connections are kept open, in seconds. Zero uses the Go default.
+	S3Timeout   *int64  // The time to wait for S3 response headers, in seconds. Zero means no timeout.
 
-	sources map[string]*Source // A map of sources, indexed under their region and bucket name.
+	sources    map[string]*Source // A map of sources, indexed under their region and bucket name.
+	sourceLock sync.RWMutex       // Used for controlling concurrent access to the source table.
+	uploads    *Uploader          // The background upload queue for freshly processed images.
+	purges     *Purger            // The background purge queue, used for fast-acknowledge purges.
+	setup      sync.Once          // Used for applying parsed configuration to the pipeline once.
+
+	flights    map[string]*flight // A map of in-progress transformations, indexed by processed path.
+	flightLock sync.Mutex         // Used for controlling concurrent access to the flight table.
+}
+
+// A flight represents an in-progress image transformation, shared between concurrent requests for
+// the same processed path. The channel is closed once the image and error fields are populated.
+type flight struct {
+	done chan struct{}
+	img  *image.Image
+	err  error
 }
 
 // Process request for image transformation, taking care caching both to local disk and S3.
 func (m *Ico) Process(w http.ResponseWriter, r *http.Request, p service.Params) (*service.Response, error) {
+	atomic.AddUint64(&metrics.requests, 1)
+	defer func(start time.Time) { metrics.process.Observe(time.Since(start)) }(time.Now())
+
+	// Apply processing options to pipeline. This cannot happen at service registration, as
+	// configuration has not been parsed at that point.
+	m.setup.Do(func() {
+		pipeline.SetConcurrency(*m.Concurrency)
+		pipeline.Start(*m.Workers, *m.Queue)
+	})
+
+	// Get source for this request, pulling the region and bucket names from request headers.
+	src, err := m.getSource(r.Header.Get("X-S3-Region"), r.Header.Get("X-S3-Bucket"))
+	if err != nil {
+		return nil, err
+	}
+
+	params, imgPath := p.Get("params"), p.Get("image")
+	if imgPath == "" {
+		return nil, fmt.Errorf("image URL is unset or empty")
+	}
+
+	// Negotiate output format against the request's Accept header, unless an
+	// explicit format was requested. The negotiated format becomes part of the
+	// processed path, so each variant is cached independently.
+	if format := negotiateFormat(params, r.Header.Get("Accept")); format != "" {
+		params += ",format=" + format
+	}
+
+	// Canonicalize parameters, so equivalent parameter lists share a single cached variant
+	// locally and on S3, regardless of the order and defaults the client spelled out.
+	if canon, err := pipeline.Canonical(params); err == nil && canon != "" {
+		params = canon
+	}
+
+	dir, file := path.Split(imgPath)
+	procPath := path.Join(dir, params, file)
+
+	// Serve existing processed files straight from the local cache file, answering conditional
+	// requests and streaming the body from disk without copying it through memory.
+	if m.serveCached(w, r, src, procPath) {
+		return nil, nil
+	}
+
+	// Fetch existing processed image, or generate it through the transformation pipeline. If the
+	// processing queue is full, shed load and have the client retry shortly.
+	img, cached, err := m.process(src, imgPath, params, procPath)
+	if err == pipeline.ErrBusy {
+		w.Header().Set("Retry-After", "1")
+		w.WriteHeader(http.StatusServiceUnavailable)
+		return nil, nil
+	} else if err != nil {
+		return nil, err
+	}
+
+	// Store image locally and upload to S3 bucket asynchronously, then write image back to user.
+	// Freshly processed images are only stored by the request that generated them. The image is
+	// explicitly kept alive until its data has been consumed, as the data buffer is owned by the
+	// pipeline and released when the image is collected.
+	if !cached {
+		m.uploads.Enqueue(src, procPath, img)
+	}
+
+	writeResponse(img.Data, img.Size, img.Type.String(), w, r)
+	runtime.KeepAlive(img)
+
+	return nil, nil
+}
+
+// Stat answers metadata requests for processed images without rendering them. Existing processed
+// images are answered from stored metadata alone; otherwise, the would-be output type and
+// dimensions are computed from the original's header, fetched via a cheap ranged probe, without
+// running the pipeline.
+func (m *Ico) Stat(w http.ResponseWriter, r *http.Request, p service.Params) (*service.Response, error) {
 	// Get source for this request, pulling the region and bucket names from request headers.
 	src, err := m.getSource(r.Header.Get("X-S3-Region"), r.Header.Get("X-S3-Bucket"))
 	if err != nil {
@@ -36,48 +138,262 @@ func (m *Ico) Process(w http.ResponseWriter, r *http.Request, p service.Params)
 		return nil, fmt.Errorf("image URL is unset or empty")
 	}
 
+	// Negotiate output format and canonicalize parameters, so metadata answers refer to the same
+	// processed path an equivalent GET request would produce.
+	if format := negotiateFormat(params, r.Header.Get("Accept")); format != "" {
+		params += ",format=" + format
+	}
+
+	if canon, err := pipeline.Canonical(params); err == nil && canon != "" {
+		params = canon
+	}
+
 	dir, file := path.Split(imgPath)
 	procPath := path.Join(dir, params, file)
 
+	// Answer from the processed object's stored metadata, if one exists locally or on S3. The
+	// metadata answered depends on the format negotiated from the Accept header, so shared caches
+	// are told to key on it.
+	if size, ctype, exists := src.Stat(procPath); exists {
+		if ctype != "" {
+			w.Header().Set("Content-Type", ctype)
+		}
+
+		w.Header().Set("Content-Length", fmt.Sprintf("%d", size))
+		w.Header().Set("Vary", "Accept")
+		w.WriteHeader(http.StatusOK)
+		return nil, nil
+	}
+
+	// Compute the would-be output metadata from the original's header alone.
+	pl, err := pipeline.New(params)
+	if err != nil {
+		return nil, fmt.Errorf("failed to initialize pipeline: %s", err)
+	}
+
+	data, err := src.GetHeader(imgPath)
+	if err != nil {
+		return nil, fmt.Errorf("failed to fetch from source: %s", err)
+	}
+
+	img, err := image.New(data)
+	if err != nil {
+		return nil, err
+	}
+
+	kind, width, height, err := pl.Stat(img)
+	if err != nil {
+		return nil, err
+	}
+
+	w.Header().Set("Content-Type", kind.String())
+	w.Header().Set("X-Image-Width", fmt.Sprintf("%d", width))
+	w.Header().Set("X-Image-Height", fmt.Sprintf("%d", height))
+	w.Header().Set("Vary", "Accept")
+	w.WriteHeader(http.StatusOK)
+
+	return nil, nil
+}
+
+// Returns the processed image for the path provided, either from cache or by running the original
+// image through the transformation pipeline. Concurrent calls for the same processed path are
+// coalesced: the first performs the fetch and transformation, while the rest block and share the
+// resulting image. The boolean returned is true if the image was served from cache or a shared
+// in-progress transformation, and false if it was generated by this call and remains to be stored.
+func (m *Ico) process(src *Source, imgPath, params, procPath string) (*image.Image, bool, error) {
 	// Fetch existing processed file, if any.
 	if img, _ := src.Get(procPath); img != nil {
-		writeResponse(img.Data, img.Size, img.Type.String(), w)
-		return nil, nil
+		return img, true, nil
+	}
+
+	// Check for an identical in-progress transformation and share its result, or register this
+	// request as the one performing the work. Flights are keyed on the source and processed path.
+	key := src.bucket.Region.Name + "/" + src.bucket.Name + procPath
+
+	m.flightLock.Lock()
+	if f, exists := m.flights[key]; exists {
+		m.flightLock.Unlock()
+		<-f.done
+		return f.img, true, f.err
 	}
 
+	f := &flight{done: make(chan struct{})}
+	m.flights[key] = f
+	m.flightLock.Unlock()
+
+	// Publish the result to any waiting requests and remove the flight, allowing future requests
+	// for the same path to be served from cache.
+	defer func() {
+		m.flightLock.Lock()
+		delete(m.flights, key)
+		m.flightLock.Unlock()
+		close(f.done)
+	}()
+
 	// Prepare pipeline and set parameters from user request.
 	pl, err := pipeline.New(params)
 	if err != nil {
-		return nil, fmt.Errorf("failed to initialize pipeline: %s", err)
+		f.err = fmt.Errorf("failed to initialize pipeline: %s", err)
+		return nil, false, f.err
 	}
 
 	// Fetch original image from remote server or local cache.
 	img, err := src.Get(imgPath)
 	if err != nil {
-		return nil, fmt.Errorf("failed to fetch from source: %s", err)
+		f.err = fmt.Errorf("failed to fetch from source: %s", err)
+		return nil, false, f.err
+	}
+
+	// Pass the original buffer through unmodified if the pipeline would leave the image
+	// unchanged, as determined from the image header alone. The original is stored under the
+	// processed path by the caller, so subsequent requests short-circuit via the cache.
+	if pl.Noop(img) {
+		atomic.AddUint64(&metrics.noops, 1)
+		f.img = img
+		return img, false, nil
+	}
+
+	// Reuse a variant already rendered for identical bytes stored under a different key, skipping
+	// the render entirely. The shared bytes are stored under this processed path by the caller, so
+	// the path contract for processed images is unaffected.
+	hash := src.Hash(imgPath)
+	if hash != "" {
+		if dup, exists := src.Variant(hash, params); exists {
+			atomic.AddUint64(&metrics.dedupes, 1)
+			f.img = dup
+			return dup, false, nil
+		}
+	}
+
+	// Process image through pipeline. Queue exhaustion is passed through untouched, so callers
+	// can distinguish load-shedding from processing failures.
+	if err = pl.Process(img); err == pipeline.ErrBusy {
+		f.err = err
+		return nil, false, f.err
+	} else if err != nil {
+		f.err = fmt.Errorf("failed to process image: %s", err)
+		return nil, false, f.err
+	}
+
+	// Record the rendered variant against the original's content hash, so future requests for
+	// identical bytes under other keys reuse this render.
+	if hash != "" {
+		src.AddVariant(hash, params, procPath)
+	}
+
+	f.img = img
+	return img, false, nil
+}
+
+// ProcessBatch generates multiple variants of a single image, for a semicolon-separated list of
+// pipeline parameter sets, e.g. 'width=200;width=400;width=800,fit=crop'. The original image is
+// fetched once and shared across all variants, each of which is stored in the local cache and S3
+// under its own processed path, as with single-variant requests.
+func (m *Ico) ProcessBatch(w http.ResponseWriter, r *http.Request, p service.Params) (*service.Response, error) {
+	atomic.AddUint64(&metrics.requests, 1)
+	defer func(start time.Time) { metrics.process.Observe(time.Since(start)) }(time.Now())
+
+	// Apply processing options to pipeline. This cannot happen at service registration, as
+	// configuration has not been parsed at that point.
+	m.setup.Do(func() {
+		pipeline.SetConcurrency(*m.Concurrency)
+		pipeline.Start(*m.Workers, *m.Queue)
+	})
+
+	// Get source for this request, pulling the region and bucket names from request headers.
+	src, err := m.getSource(r.Header.Get("X-S3-Region"), r.Header.Get("X-S3-Bucket"))
+	if err != nil {
+		return nil, err
+	}
+
+	params, imgPath := p.Get("params"), p.Get("image")
+	if imgPath == "" {
+		return nil, fmt.Errorf("image URL is unset or empty")
 	}
 
-	// Process image through pipeline.
-	if err = pl.Process(img); err != nil {
-		return nil, fmt.Errorf("failed to process image: %s", err)
+	// Fetch original image from remote server or local cache once, for use by all variants.
+	orig, err := src.Get(imgPath)
+	if err != nil {
+		return nil, fmt.Errorf("failed to fetch from source: %s", err)
 	}
 
-	// If processing a GET request, store image locally and upload to S3 bucket asynchronously, then
-	// write image back to user. Otherwise, wait for upload process to complete and return nothing.
-	switch r.Method {
-	case "GET":
-		go src.Put(procPath, img.Data, img.Type.String())
-		writeResponse(img.Data, img.Size, img.Type.String(), w)
-	default:
+	dir, file := path.Split(imgPath)
+	hash := src.Hash(imgPath)
+	result := make(map[string]string)
+
+	for _, prm := range strings.Split(params, ";") {
+		// Negotiate output format and canonicalize parameters for each variant, as for
+		// single-variant requests. The result map is keyed on the parameter set as the client
+		// spelled it, so the canonical form is tracked separately; the path mapped to embeds
+		// the canonical form, as that is where the variant is stored.
+		canon := prm
+		if format := negotiateFormat(canon, r.Header.Get("Accept")); format != "" {
+			canon += ",format=" + format
+		}
+
+		if c, err := pipeline.Canonical(canon); err == nil && c != "" {
+			canon = c
+		}
+
+		procPath := path.Join(dir, canon, file)
+
+		// Skip variants which have already been processed and cached.
+		if img, _ := src.Get(procPath); img != nil {
+			result[prm] = procPath
+			continue
+		}
+
+		// Reuse a variant already rendered for identical bytes stored under a different key,
+		// storing the shared bytes under this processed path without rendering.
+		if hash != "" {
+			if dup, exists := src.Variant(hash, canon); exists {
+				atomic.AddUint64(&metrics.dedupes, 1)
+				src.Put(procPath, dup.Data, dup.Type.String())
+				result[prm] = procPath
+				continue
+			}
+		}
+
+		// Prepare pipeline and set parameters from user request.
+		pl, err := pipeline.New(canon)
+		if err != nil {
+			return nil, fmt.Errorf("failed to initialize pipeline: %s", err)
+		}
+
+		// Process a shallow copy of the original image, sharing the fetched source buffer
+		// across variants. Each variant decodes the shared buffer independently: resize
+		// variants decode at their target scale via shrink-on-load, which for typical batches
+		// is cheaper than sharing a single full-resolution decode.
+		img := &image.Image{Data: orig.Data, Size: orig.Size, Type: orig.Type}
+		if err = pl.Process(img); err == pipeline.ErrBusy {
+			w.Header().Set("Retry-After", "1")
+			w.WriteHeader(http.StatusServiceUnavailable)
+			return nil, nil
+		} else if err != nil {
+			return nil, fmt.Errorf("failed to process image: %s", err)
+		}
+
 		src.Put(procPath, img.Data, img.Type.String())
-		return &service.Response{http.StatusOK, map[string]bool{"result": true}}, nil
+		runtime.KeepAlive(img)
+
+		if hash != "" {
+			src.AddVariant(hash, canon, procPath)
+		}
+
+		result[prm] = procPath
 	}
 
-	return nil, nil
+	// The original is explicitly kept alive until all variants have been processed, as its data
+	// buffer may be backed by a memory mapping released when the image is collected.
+	runtime.KeepAlive(orig)
+
+	return &service.Response{http.StatusOK, result}, nil
 }
 
 // Purge removes the original image pointed to by the request, along with any processed child images
-// in the local cache and the remote server.
+// in the local cache and the remote server. Requests carrying an 'X-Purge-Async' header are queued
+// and acknowledged immediately, so bulk invalidations do not hold request slots for the duration of
+// the S3 fan-out.
 func (m *Ico) Purge(w http.ResponseWriter, r *http.Request, p service.Params) (*service.Response, error) {
 	// Get source for this request, pulling the region and bucket names from request headers.
 	src, err := m.getSource(r.Header.Get("X-S3-Region"), r.Header.Get("X-S3-Bucket"))
@@ -91,21 +407,19 @@ func (m *Ico) Purge(w http.ResponseWriter, r *http.Request, p service.Params) (*
 		return nil, fmt.Errorf("image URL is unset or empty")
 	}
 
-	imgDir, imgName := path.Split(imgPath)
-
-	// Fetch list of directories in image path and append image name to each directory.
-	dirList, err := src.ListDirs(imgDir)
-	if err != nil {
-		return nil, err
-	}
+	// Queue purge and acknowledge immediately, if requested. A full queue sheds load and has the
+	// client retry, as dropping the purge silently would leave stale variants in place.
+	if r.Header.Get("X-Purge-Async") != "" {
+		if !m.purges.Enqueue(src, imgPath) {
+			w.Header().Set("Retry-After", "1")
+			w.WriteHeader(http.StatusServiceUnavailable)
+			return nil, nil
+		}
 
-	dirList = append(dirList, imgDir)
-	for i := range dirList {
-		dirList[i] = path.Join(dirList[i], imgName)
+		return &service.Response{http.StatusAccepted, map[string]bool{"queued": true}}, nil
 	}
 
-	// Delete images from local and remote cache.
-	if err = src.Delete(dirList...); err != nil {
+	if err = purgeImage(src, imgPath); err != nil {
 		return nil, err
 	}
 
@@ -118,6 +432,9 @@ func (m *Ico) getSource(region, bucket string) (*Source, error) {
 	var err error
 	var access, secret string
 
+	// Tune the shared S3 transport before the first connection is made.
+	SetupTransport(*m.S3MaxIdle, *m.S3KeepAlive, *m.S3Timeout)
+
 	// Fall back to default values if either region name or bucket name is empty.
 	if region == "" || bucket == "" {
 		access, secret = *m.S3AccessKey, *m.S3SecretKey
@@ -126,28 +443,133 @@ func (m *Ico) getSource(region, bucket string) (*Source, error) {
 
 	key := region + "/" + bucket
 
-	// Check for existing source, or initialize new source for specified region and bucket.
+	// Check for an existing source under the read lock, which is the common case once a source has
+	// been initialized.
+	m.sourceLock.RLock()
 	src, exists := m.sources[key]
-	if !exists {
-		if src, err = NewSource(region, bucket, access, secret); err != nil {
-			return nil, err
-		}
+	m.sourceLock.RUnlock()
+
+	if exists {
+		return src, nil
+	}
+
+	// Initialize new source for specified region and bucket under the write lock, re-checking for
+	// a source registered by a concurrent request in the meantime.
+	m.sourceLock.Lock()
+	defer m.sourceLock.Unlock()
+
+	if src, exists = m.sources[key]; exists {
+		return src, nil
+	}
+
+	if src, err = NewSource(region, bucket, access, secret); err != nil {
+		return nil, err
+	}
+
+	if err = src.InitCache("mash/ico", *m.Quota, *m.Memory); err != nil {
+		return nil, err
+	}
+
+	m.sources[key] = src
+	return src, nil
+}
+
+// Returns the preferred output format for the Accept header provided, or an empty string if the
+// client expressed no preference Ico can serve. An explicit 'format' pipeline parameter always
+// takes precedence over negotiation.
+func negotiateFormat(params, accept string) string {
+	if strings.Contains(params, "format=") {
+		return ""
+	}
 
-		if err = src.InitCache("mash/ico", *m.Quota); err != nil {
-			return nil, err
+	// Prefer AVIF over WebP, as it typically compresses better for equivalent quality.
+	for _, format := range []string{"avif", "webp"} {
+		if strings.Contains(accept, "image/"+format) {
+			return format
 		}
+	}
+
+	return ""
+}
+
+// Serves the processed file stored under `procPath` directly from the local cache file, if any
+// exists. Conditional requests are answered with 304 before the file is touched at all, and full
+// responses stream from the open file handle, using sendfile where the platform supports it.
+// Returns false if no cached file exists, or it could not be served for any reason.
+func (m *Ico) serveCached(w http.ResponseWriter, r *http.Request, src *Source, procPath string) bool {
+	if src.cache == nil {
+		return false
+	}
+
+	name, hash, exists := src.cache.Stat(procPath)
+	if !exists {
+		return false
+	}
 
-		m.sources[key] = src
+	etag := `"` + hash + `"`
+
+	// Answer revalidation requests from book-keeping alone, avoiding the body entirely. The body
+	// served under this path depends on the negotiated output format, so shared caches are told
+	// to key on the Accept header, on 304 responses included.
+	if r.Header.Get("If-None-Match") == etag {
+		w.Header().Set("ETag", etag)
+		w.Header().Set("Cache-Control", "no-transform,public,max-age=86400,s-maxage=2592000")
+		w.Header().Set("Vary", "Accept")
+		w.WriteHeader(http.StatusNotModified)
+		return true
+	}
+
+	fl, err := os.Open(name)
+	if err != nil {
+		return false
+	}
+	defer fl.Close()
+
+	info, err := fl.Stat()
+	if err != nil {
+		return false
+	}
+
+	// Determine content type from the file's magic header, as the path extension may not match
+	// the negotiated output format.
+	var hdr [2]byte
+	if _, err := fl.ReadAt(hdr[:], 0); err != nil {
+		return false
+	}
+
+	if k, valid := image.Type(hdr[:]); valid {
+		w.Header().Set("Content-Type", k.String())
 	}
 
-	return m.sources[key], nil
+	w.Header().Set("ETag", etag)
+	w.Header().Set("Cache-Control", "no-transform,public,max-age=86400,s-maxage=2592000")
+	w.Header().Set("Vary", "Accept")
+
+	// ServeContent handles Range and any remaining conditional headers, and streams *os.File
+	// bodies through sendfile where available.
+	http.ServeContent(w, r, "", info.ModTime(), fl)
+	return true
 }
 
-// Writes image data back to user.
-func writeResponse(data []byte, size int64, ctype string, w http.ResponseWriter) {
+// Writes image data back to user, answering conditional requests with 304 where the entity tag
+// derived from the data matches.
+func writeResponse(data []byte, size int64, ctype string, w http.ResponseWriter, r *http.Request) {
+	etag := `"` + hashData(data) + `"`
+
+	w.Header().Set("ETag", etag)
+	w.Header().Set("Cache-Control", "no-transform,public,max-age=86400,s-maxage=2592000")
+
+	// The response body depends on the format negotiated from the request's Accept header, so
+	// shared caches must key on it, lest a negotiated body be served to clients not accepting it.
+	w.Header().Set("Vary", "Accept")
+
+	if r != nil && r.Header.Get("If-None-Match") == etag {
+		w.WriteHeader(http.StatusNotModified)
+		return
+	}
+
 	w.Header().Set("Content-Type", ctype)
 	w.Header().Set("Content-Length", fmt.Sprintf("%d", size))
-	w.Header().Set("Cache-Control", "no-transform,public,max-age=86400,s-maxage=2592000")
 	w.WriteHeader(http.StatusOK)
 	w.Write(data)
 }
@@ -157,17 +579,34 @@ func init() {
 	flags := flag.NewFlagSet("ico", flag.ContinueOnError)
 	serv := &Ico{
 		Quota:       flags.Int64("quota", 0, ""),
+		Memory:      flags.Int64("memory", 0, ""),
+		Concurrency: flags.Int64("concurrency", 0, ""),
+		Workers:     flags.Int64("workers", 0, ""),
+		Queue:       flags.Int64("queue", 0, ""),
 		S3Region:    flags.String("s3-region", "", ""),
 		S3Bucket:    flags.String("s3-bucket", "", ""),
 		S3AccessKey: flags.String("s3-access-key", "", ""),
 		S3SecretKey: flags.String("s3-secret-key", "", ""),
+		S3MaxIdle:   flags.Int64("s3-max-idle", 0, ""),
+		S3KeepAlive: flags.Int64("s3-keep-alive", 0, ""),
+		S3Timeout:   flags.Int64("s3-timeout", 0, ""),
 		sources:     make(map[string]*Source),
+		uploads:     NewUploader(),
+		purges:      NewPurger(),
+		flights:     make(map[string]*flight),
 	}
 
 	// Register Ico service along with handler methods.
 	service.Register("ico", flags, []service.Handler{
-		{"HEAD", "/:params/*image", serv.Process},
+		{"HEAD", "/:params/*image", serv.Stat},
 		{"GET", "/:params/*image", serv.Process},
+		{"POST", "/:params/*image", serv.ProcessBatch},
 		{"DELETE", "/*image", serv.Purge},
 	})
+
+	// Register metrics endpoint under its own prefix, as the processing routes above capture all
+	// paths under the service prefix as pipeline parameters.
+	service.Register("metrics", nil, []service.Handler{
+		{"GET", "/ico", serv.Metrics},
+	})
 }
@@ -12,12 +12,16 @@ const (
 	JPEG Kind = iota
 	PNG
 	GIF
+	WEBP
+	AVIF
 )
 
 var kindTypeLookup = map[Kind]string{
 	JPEG: "image/jpeg",
 	PNG:  "image/png",
 	GIF:  "image/gif",
+	WEBP: "image/webp",
+	AVIF: "image/avif",
 }
 
 // String returns the internal representation of the image Kind as a MIME type.
@@ -31,6 +35,21 @@ type Image struct {
 	Data []byte // The image data buffer
 	Size int64  // The image size, in bytes.
 	Type Kind   // The image MIME type.
+
+	// Free, when set, releases the resources backing the data buffer, e.g. a
+	// memory mapping or a buffer owned by the processing pipeline. It is
+	// invoked through Release, either explicitly or by a finalizer, once the
+	// image and its data are no longer referenced.
+	Free func()
+}
+
+// Release frees the resources backing the image's data buffer, if any, and is
+// safe to call more than once. The data buffer must not be accessed afterwards.
+func (i *Image) Release() {
+	if i.Free != nil {
+		i.Free()
+		i.Free = nil
+	}
 }
 
 // The file signature, used for determining the type of file.
@@ -41,6 +60,23 @@ var magicHeaderLookup = map[magicHeader]Kind{
 	magicHeader{0xff, 0xd8}: JPEG,
 	magicHeader{0x89, 0x50}: PNG,
 	magicHeader{0x47, 0x49}: GIF,
+	magicHeader{0x52, 0x49}: WEBP, // The 'RIFF' container header, used by WebP.
+	magicHeader{0x00, 0x00}: AVIF, // The ISOBMFF 'ftyp' box size prefix, used by AVIF.
+}
+
+// Type returns the image Kind corresponding to the data buffer provided, as
+// determined by its magic header. The boolean returned is false if the buffer
+// is too short or does not correspond to any known image type handled by Ico.
+func Type(data []byte) (Kind, bool) {
+	if len(data) < 2 {
+		return 0, false
+	}
+
+	var m magicHeader
+	copy(m[:], data[:2])
+
+	k, ok := magicHeaderLookup[m]
+	return k, ok
 }
 
 // New creates a new image representation for the data buffer provided. It returns
@@ -54,12 +90,10 @@ func New(data []byte) (*Image, error) {
 	}
 
 	// Check for valid image MIME type.
-	var m magicHeader
-	copy(m[:], data[:2])
-
-	if _, ok := magicHeaderLookup[m]; !ok {
+	k, ok := Type(data)
+	if !ok {
 		return nil, fmt.Errorf("unknown or unhandled file type for data buffer")
 	}
 
-	return &Image{Data: data, Size: l, Type: magicHeaderLookup[m]}, nil
+	return &Image{Data: data, Size: l, Type: k}, nil
 }
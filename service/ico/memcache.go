@@ -0,0 +1,161 @@
+package ico
+
+import (
+	// Standard library
+	"sync"
+	"time"
+)
+
+// The number of candidates sampled when evicting an object from memory. Larger samples approximate
+// true least-frequently-used eviction more closely, at the cost of longer scans under the lock.
+const evictSample = 5
+
+// MemCache implements a size-bounded in-memory cache for arbitrary data, and is intended as a hot
+// tier above the disk-based FileCache. Eviction is frequency-aware: a small sample of objects is
+// examined and the least frequently used is dropped, so one-off scans through the key space do not
+// displace the persistently hot set.
+type MemCache struct {
+	quota int64 // The memory quota, in bytes. A value of zero means no limit.
+	usage int64 // The current memory usage, in bytes.
+
+	hits      uint64 // The number of lookups answered from the cache.
+	misses    uint64 // The number of lookups for objects not in the cache.
+	evictions uint64 // The number of objects evicted to stay within quota.
+
+	cache map[string]*object // A lookup table of object names to resident objects.
+
+	sync.Mutex // Used for controlling concurrent access to the lookup table.
+}
+
+// An object represents a cached item along with the book-keeping used for eviction decisions.
+type object struct {
+	data []byte
+	hits int64
+	used time.Time
+}
+
+// NewMemCache initializes an in-memory cache with an optional quota on the total size of resident
+// objects. If the size of the quota is zero, the limit is assumed to be infinite.
+func NewMemCache(quota int64) *MemCache {
+	return &MemCache{
+		quota: quota,
+		cache: make(map[string]*object),
+	}
+}
+
+// Add inserts `value` under `key`, evicting less frequently used objects as needed to make room.
+// Variable `value` is assumed to be a `[]byte` type, but is passed as an `interface{}` type to
+// satisfy the generic `Cacher` interface. The data is copied on insertion, as callers may pass
+// buffers whose lifetime is managed externally.
+func (m *MemCache) Add(key string, value interface{}) {
+	var ok bool
+	var data []byte
+
+	// Refuse to store non-byte-slice data.
+	if data, ok = value.([]byte); !ok {
+		return
+	}
+
+	// Do not store data whose size is equal to or larger than the quota size.
+	if m.quota > 0 && int64(len(data)) >= m.quota {
+		return
+	}
+
+	m.Lock()
+	defer m.Unlock()
+
+	// If object already exists, mark as used and return.
+	if o, exists := m.cache[key]; o != nil && exists {
+		o.hits++
+		o.used = time.Now()
+		return
+	}
+
+	// Evict objects until the new object fits within quota.
+	for m.quota > 0 && m.usage+int64(len(data)) > m.quota {
+		if !m.evict() {
+			return
+		}
+	}
+
+	m.cache[key] = &object{
+		data: append([]byte(nil), data...),
+		hits: 1,
+		used: time.Now(),
+	}
+
+	m.usage += int64(len(data))
+}
+
+// Get returns data stored under `key`, or `nil` if no data exists.
+func (m *MemCache) Get(key string) interface{} {
+	m.Lock()
+	defer m.Unlock()
+
+	o, exists := m.cache[key]
+	if !exists {
+		m.misses++
+		return nil
+	}
+
+	m.hits++
+	o.hits++
+	o.used = time.Now()
+
+	return o.data
+}
+
+// Remove removes object stored under `key`.
+func (m *MemCache) Remove(key string) {
+	m.Lock()
+	defer m.Unlock()
+
+	if o, exists := m.cache[key]; exists {
+		m.usage -= int64(len(o.data))
+		delete(m.cache, key)
+	}
+}
+
+// Removes the least frequently used object of a small sample, breaking ties by access time.
+// Returns false if the cache holds no objects to remove. Assumes the cache lock is held.
+func (m *MemCache) evict() bool {
+	var victim string
+	var found *object
+
+	// Map iteration order is randomized, which makes taking the first entries a cheap sample.
+	n := 0
+	for key, o := range m.cache {
+		if found == nil || o.hits < found.hits || (o.hits == found.hits && o.used.Before(found.used)) {
+			victim, found = key, o
+		}
+
+		if n++; n >= evictSample {
+			break
+		}
+	}
+
+	if found == nil {
+		return false
+	}
+
+	m.usage -= int64(len(found.data))
+	delete(m.cache, victim)
+	m.evictions++
+
+	return true
+}
+
+// Stats returns a point-in-time snapshot of cache usage and hit statistics.
+func (m *MemCache) Stats() map[string]interface{} {
+	m.Lock()
+	defer m.Unlock()
+
+	return map[string]interface{}{
+		"usage":     m.usage,
+		"quota":     m.quota,
+		"objects":   len(m.cache),
+		"hits":      m.hits,
+		"misses":    m.misses,
+		"evictions": m.evictions,
+	}
+}
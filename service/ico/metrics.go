@@ -0,0 +1,63 @@
+package ico
+
+import (
+	// Standard library
+	"net/http"
+	"sync/atomic"
+
+	// Internal packages
+	"github.com/deuill/mash/service"
+	"github.com/deuill/mash/service/ico/pipeline"
+)
+
+// Counters and latency distributions collected across the service, covering
+// request handling and remote fetches. Cache and pipeline-stage statistics
+// are tracked by their owning types and merged into the metrics response.
+var metrics struct {
+	requests uint64 // The total number of processing requests handled.
+	noops    uint64 // The number of requests answered with the original image unmodified.
+	dedupes  uint64 // The number of renders skipped by reusing a variant of identical bytes.
+
+	fetch   pipeline.Histogram // Time spent fetching originals from S3.
+	process pipeline.Histogram // End-to-end request handling time.
+}
+
+// Metrics reports operational statistics for the service: request counts and
+// end-to-end latency, S3 fetch latency, per-source cache usage and hit ratios,
+// upload queue state, and per-stage pipeline timings along with memory and
+// operation-cache figures tracked by VIPS.
+func (m *Ico) Metrics(w http.ResponseWriter, r *http.Request, p service.Params) (*service.Response, error) {
+	m.sourceLock.RLock()
+	defer m.sourceLock.RUnlock()
+
+	sources := make(map[string]interface{}, len(m.sources))
+	for name, src := range m.sources {
+		s := make(map[string]interface{}, 2)
+		if src.cache != nil {
+			s["disk"] = src.cache.Stats()
+		}
+		if src.mem != nil {
+			s["memory"] = src.mem.Stats()
+		}
+
+		sources[name] = s
+	}
+
+	return &service.Response{http.StatusOK, map[string]interface{}{
+		"requests": atomic.LoadUint64(&metrics.requests),
+		"noops":    atomic.LoadUint64(&metrics.noops),
+		"dedupes":  atomic.LoadUint64(&metrics.dedupes),
+		"process":  metrics.process.Stats(),
+		"fetch":    metrics.fetch.Stats(),
+		"sources":  sources,
+		"uploads": map[string]interface{}{
+			"depth":   m.uploads.Depth(),
+			"dropped": m.uploads.Dropped(),
+		},
+		"purges": map[string]interface{}{
+			"depth":   m.purges.Depth(),
+			"dropped": m.purges.Dropped(),
+		},
+		"pipeline": pipeline.Stats(),
+	}}, nil
+}
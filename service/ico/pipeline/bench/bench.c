@@ -0,0 +1,186 @@
+// A standalone benchmark driver for the C image pipeline, exercising image
+// open, shrink, affine resize, crop and write over a corpus of representative
+// JPEG and PNG images. The corpus is synthesized in memory at startup, so no
+// binary assets need to be checked in and results are reproducible anywhere
+// VIPS is available.
+//
+// Build and run via 'make bench' from the repository root. Reported figures
+// are per-stage mean latency, overall pixel throughput, and peak RSS. Note
+// that shrink, affine and crop only append to the operation graph; the actual
+// pixel work is deferred to evaluation at write time, which is where their
+// cost shows up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <vips/vips.h>
+
+#include "pipeline.h"
+#include "resize.h"
+
+// A corpus entry, pairing representative image dimensions with an iteration
+// count scaled to keep per-entry run time roughly level.
+struct corpus {
+	const char *name;
+	int width;
+	int height;
+	int runs;
+};
+
+static struct corpus sizes[] = {
+	{"small", 640, 480, 64},
+	{"medium", 1920, 1080, 16},
+	{"large", 4032, 3024, 4},
+};
+
+static struct {
+	const char *name;
+	int type;
+} formats[] = {
+	{"jpeg", TYPE_JPEG},
+	{"png", TYPE_PNG},
+};
+
+// Shrink factors exercised for each corpus entry, mirroring the integer
+// factors produced by typical thumbnail requests.
+static double factors[] = {2, 4, 8};
+
+// Returns a monotonic timestamp, in seconds.
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// Synthesizes an encoded image of the given dimensions and format, returning
+// the encoded buffer. Gaussian noise is used as source material, keeping the
+// encoders honest about per-pixel cost.
+static int make_image(int type, int width, int height, void **buf, size_t *len) {
+	VipsImage *img;
+
+	if (vips_gaussnoise(&img, width, height, NULL)) {
+		return 1;
+	}
+
+	int err;
+	switch (type) {
+	case TYPE_PNG:
+		err = vips_pngsave_buffer(img, buf, len, NULL);
+		break;
+	default:
+		err = vips_jpegsave_buffer(img, buf, len, NULL);
+		break;
+	}
+
+	g_object_unref(img);
+	return err;
+}
+
+// Runs the full pipeline against the encoded buffer provided, accumulating
+// per-stage wall time into the array passed in. Returns non-zero on failure.
+static int run_pipeline(const void *data, size_t len, int type, double factor, double stage[5]) {
+	double start;
+
+	start = now();
+	ico_image *img = ico_image_new(data, len, type, 0, 0);
+	stage[0] += now() - start;
+
+	if (img == NULL) {
+		return 1;
+	}
+
+	start = now();
+	ico_image_shrink(img, factor);
+	stage[1] += now() - start;
+
+	start = now();
+	ico_image_affine(img, 1.5, INTERP_BILINEAR);
+	stage[2] += now() - start;
+
+	int w = ico_image_width(img), h = ico_image_height(img);
+
+	start = now();
+	ico_image_crop(img, w / 4, h / 4, w / 2, h / 2);
+	stage[3] += now() - start;
+
+	void *out = NULL;
+	size_t outlen = 0;
+
+	start = now();
+	ico_image_write(img, &out, &outlen);
+	stage[4] += now() - start;
+
+	ico_image_destroy(img);
+
+	if (out == NULL) {
+		return 1;
+	}
+
+	g_free(out);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (VIPS_INIT(argv[0])) {
+		fprintf(stderr, "failed to initialize VIPS\n");
+		return 1;
+	}
+
+	if (ico_init()) {
+		fprintf(stderr, "failed to initialize pipeline: %s\n", ico_error());
+		return 1;
+	}
+
+	printf("%-8s %-8s %8s %6s %10s %10s %10s %10s %10s %12s\n",
+	       "format", "size", "shrink", "runs",
+	       "open ms", "shrink ms", "affine ms", "crop ms", "write ms", "through MP/s");
+
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			struct corpus *c = &sizes[s];
+
+			void *data = NULL;
+			size_t len = 0;
+
+			if (make_image(formats[f].type, c->width, c->height, &data, &len)) {
+				fprintf(stderr, "failed to synthesize %s image: %s\n", formats[f].name, vips_error_buffer());
+				return 1;
+			}
+
+			for (size_t k = 0; k < sizeof(factors) / sizeof(factors[0]); k++) {
+				double stage[5] = {0};
+				double start = now();
+
+				for (int i = 0; i < c->runs; i++) {
+					if (run_pipeline(data, len, formats[f].type, factors[k], stage)) {
+						fprintf(stderr, "failed to process image: %s\n", ico_error());
+						return 1;
+					}
+				}
+
+				double total = now() - start;
+				double pixels = (double) c->width * c->height * c->runs;
+
+				printf("%-8s %-8s %8.0f %6d %10.2f %10.2f %10.2f %10.2f %10.2f %12.2f\n",
+				       formats[f].name, c->name, factors[k], c->runs,
+				       stage[0] * 1000 / c->runs, stage[1] * 1000 / c->runs,
+				       stage[2] * 1000 / c->runs, stage[3] * 1000 / c->runs,
+				       stage[4] * 1000 / c->runs, pixels / total / 1e6);
+			}
+
+			g_free(data);
+		}
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("\npeak RSS: %ld KB, VIPS tracked memory high-water: %zu KB\n",
+	       usage.ru_maxrss, vips_tracked_get_mem_highwater() / 1024);
+
+	vips_shutdown();
+	return 0;
+}
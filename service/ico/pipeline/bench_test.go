@@ -0,0 +1,73 @@
+package pipeline
+
+import (
+	// Standard library.
+	"testing"
+)
+
+// A mix of representative parameter lists, covering plain resizes, crops and
+// format conversion with encoder options.
+var benchParams = []string{
+	"width=200",
+	"width=300,height=200",
+	"width=300,height=200,fit=crop",
+	"width=500,height=500,fit=crop:left",
+	"width=800,format=webp,quality=80",
+	"width=1024,height=768,format=avif,strip=1",
+}
+
+// Benchmarks pipeline compilation from scratch, covering parameter parsing
+// and reflection-driven unpacking into operations.
+func BenchmarkPipelineCompile(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		if _, err := compile(benchParams[i%len(benchParams)]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// Benchmarks pipeline lookup through the compiled-pipeline cache, which is
+// the path taken by repeat requests.
+func BenchmarkPipelineNew(b *testing.B) {
+	// Warm the cache, so the benchmark measures hits alone.
+	for _, p := range benchParams {
+		if _, err := New(p); err != nil {
+			b.Fatal(err)
+		}
+	}
+
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			if _, err := New(benchParams[i%len(benchParams)]); err != nil {
+				b.Fatal(err)
+			}
+			i++
+		}
+	})
+}
+
+// Benchmarks unpacking a parsed parameter list into an operation structure.
+func BenchmarkParamsUnpack(b *testing.B) {
+	prm, err := Parse("width=300,height=200,fit=crop:point:150:150")
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	for i := 0; i < b.N; i++ {
+		r := &Resize{}
+		if err := prm.Unpack(r); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// Benchmarks parameter canonicalization, which runs once per request.
+func BenchmarkParamsCanonical(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		if _, err := Canonical("height=200,fit=clip,width=300,quality=0"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
@@ -0,0 +1,129 @@
+package pipeline
+
+// #cgo pkg-config: vips
+// #cgo CFLAGS: -Iinclude
+//
+// #include <stdlib.h>
+// #include <vips/vips.h>
+//
+// #include "pipeline.h"
+import "C"
+
+import (
+	// Standard library.
+	"fmt"
+
+	// Internal packages.
+	"github.com/deuill/mash/service/ico/image"
+)
+
+// Format is an operation for controlling how images are encoded, covering both
+// conversion between formats, e.g. for serving WebP or AVIF variants of JPEG
+// and PNG originals, and tunable encoder options such as quality and metadata
+// stripping.
+type Format struct {
+	Kind        string `key:"format" valid:"jpeg|png|gif|webp|avif"`
+	Quality     int64  `key:"quality" valid:"^(0|[1-9][0-9]?|100)$"`
+	Compression int64  `key:"compression" default:"-1" valid:"^(-1|[0-9])$"`
+	Interlace   int64  `key:"interlace" valid:"0|1"`
+	Strip       int64  `key:"strip" valid:"0|1"`
+}
+
+// An ordered lookup table of format names against internal pipeline types.
+var formatTypeLookup = map[string]C.int{
+	"jpeg": C.TYPE_JPEG,
+	"png":  C.TYPE_PNG,
+	"gif":  C.TYPE_GIF,
+	"webp": C.TYPE_WEBP,
+	"avif": C.TYPE_AVIF,
+}
+
+// A lookup table of image kinds against their format parameter names.
+var kindFormatLookup = map[image.Kind]string{
+	image.JPEG: "jpeg",
+	image.PNG:  "png",
+	image.GIF:  "gif",
+	image.WEBP: "webp",
+	image.AVIF: "avif",
+}
+
+// A lookup table of format parameter names against image kinds.
+var formatKindLookup = map[string]image.Kind{
+	"jpeg": image.JPEG,
+	"png":  image.PNG,
+	"gif":  image.GIF,
+	"webp": image.WEBP,
+	"avif": image.AVIF,
+}
+
+// Process sets the output format and encoder options for the image provided.
+// The conversion itself happens when the operation graph is evaluated and
+// encoded at write time.
+func (f *Format) Process(img *C.ico_image) error {
+	if f.Kind != "" {
+		t, ok := formatTypeLookup[f.Kind]
+		if !ok {
+			return fmt.Errorf("unknown output format '%s'", f.Kind)
+		}
+
+		C.ico_image_format(img, t)
+	}
+
+	C.ico_image_encode(img, C.int(f.Quality), C.int(f.Compression), C.int(f.Interlace), C.int(f.Strip))
+	return nil
+}
+
+// Name returns the name this operation is tracked under in statistics.
+func (f *Format) Name() string {
+	return "format"
+}
+
+// Sequential returns true, as format conversion happens entirely at encode
+// time and places no constraints on pixel access order.
+func (f *Format) Sequential() bool {
+	return true
+}
+
+// Animated returns true, as the GIF and WebP encoders both preserve frames in
+// multi-frame sources, and remaining formats encode the first frame only.
+func (f *Format) Animated() bool {
+	return true
+}
+
+// Noop returns true if the requested output format matches the source format
+// and no encoder options are set, leaving the encoded result equivalent.
+func (f *Format) Noop(kind image.Kind, width, height int64) bool {
+	if f.Quality != 0 || f.Compression >= 0 || f.Interlace != 0 || f.Strip != 0 {
+		return false
+	}
+
+	return kindFormatLookup[kind] == f.Kind
+}
+
+// Bounds returns the image type that would result from applying the format
+// conversion, leaving dimensions unchanged.
+func (f *Format) Bounds(kind image.Kind, width, height int64) (image.Kind, int64, int64) {
+	if k, exists := formatKindLookup[f.Kind]; exists {
+		kind = k
+	}
+
+	return kind, width, height
+}
+
+// NewFormat attempts to initialize a format operation from the parameters
+// provided. The operation is skipped if no output format is requested.
+func NewFormat(p *Params) (Operation, error) {
+	// Instantiate and unpack pipeline parameters into operation.
+	f := &Format{}
+	if err := p.Unpack(f); err != nil {
+		return nil, err
+	}
+
+	// Check for required pipeline parameters. The operation applies if either
+	// an output format or any encoder option is requested.
+	if f.Kind == "" && f.Quality == 0 && f.Compression < 0 && f.Interlace == 0 && f.Strip == 0 {
+		return nil, nil
+	}
+
+	return f, nil
+}
@@ -8,22 +8,39 @@ typedef struct __ico_image {
 		size_t len;
 	} data;
 	int type;
+	int sequential;
+	int animated;
+	struct {
+		int quality;
+		int compression;
+		int interlace;
+		int strip;
+	} encode;
 } ico_image;
 
 enum {
 	TYPE_JPEG,
 	TYPE_PNG,
 	TYPE_GIF,
+	TYPE_WEBP,
+	TYPE_AVIF,
 };
 
 int ico_init();
+void ico_concurrency(int threads);
 const char *ico_error();
+void ico_stats(size_t *mem, size_t *mem_high, int *allocs, int *ops);
 
-ico_image *ico_image_new(const void *data, size_t len, int type);
+ico_image *ico_image_new(const void *data, size_t len, int type, int sequential, int animated);
+int ico_image_size(const void *data, size_t len, int *width, int *height);
+void ico_image_chain(ico_image *img, VipsImage *next);
 void ico_image_write(ico_image *img, void **buf, size_t *len);
 void ico_image_destroy(ico_image *img);
 
 int ico_image_width(ico_image *img);
 int ico_image_height(ico_image *img);
+int ico_image_type(ico_image *img);
+void ico_image_format(ico_image *img, int type);
+void ico_image_encode(ico_image *img, int quality, int compression, int interlace, int strip);
 
 #endif
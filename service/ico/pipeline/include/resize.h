@@ -1,8 +1,15 @@
 #ifndef __RESIZE_H__
 #define __RESIZE_H__
 
+enum {
+	INTERP_BILINEAR,
+	INTERP_BICUBIC,
+	INTERP_LANCZOS3,
+};
+
 void ico_image_shrink(ico_image *img, double factor);
-void ico_image_affine(ico_image *img, double factor);
+void ico_image_affine(ico_image *img, double factor, int interp);
 void ico_image_crop(ico_image *img, int x, int y, int w, int h);
+void ico_image_thumbnail(ico_image *img, int width, int height, int crop);
 
 #endif
@@ -0,0 +1,144 @@
+package pipeline
+
+// #cgo pkg-config: vips
+// #cgo CFLAGS: -Iinclude
+//
+// #include <stdlib.h>
+// #include <vips/vips.h>
+//
+// #include "pipeline.h"
+import "C"
+
+import (
+	// Standard library.
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// Upper bounds for histogram buckets, in milliseconds. Observations larger
+// than the last bound fall into an implicit overflow bucket.
+var bucketBounds = []int64{1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000}
+
+// A Histogram tracks the distribution of observed durations across a fixed
+// set of latency buckets, along with a total count and sum. All fields are
+// updated atomically, so observations never contend on a lock.
+type Histogram struct {
+	count   uint64
+	sum     uint64 // Total observed time, in nanoseconds.
+	buckets [len(bucketBounds) + 1]uint64
+}
+
+// Observe records a single duration against the histogram.
+func (h *Histogram) Observe(d time.Duration) {
+	atomic.AddUint64(&h.count, 1)
+	atomic.AddUint64(&h.sum, uint64(d))
+
+	ms := d.Milliseconds()
+	for i, b := range bucketBounds {
+		if ms <= b {
+			atomic.AddUint64(&h.buckets[i], 1)
+			return
+		}
+	}
+
+	atomic.AddUint64(&h.buckets[len(bucketBounds)], 1)
+}
+
+// Stats returns a point-in-time snapshot of the histogram, with bucket counts
+// keyed on their upper bounds, suitable for serializing in a metrics response.
+func (h *Histogram) Stats() map[string]interface{} {
+	count := atomic.LoadUint64(&h.count)
+	sum := atomic.LoadUint64(&h.sum)
+
+	var mean float64
+	if count > 0 {
+		mean = float64(sum) / float64(count) / float64(time.Millisecond)
+	}
+
+	buckets := make(map[string]uint64, len(bucketBounds)+1)
+	for i, b := range bucketBounds {
+		buckets[strconv.FormatInt(b, 10)+"ms"] = atomic.LoadUint64(&h.buckets[i])
+	}
+	buckets["+inf"] = atomic.LoadUint64(&h.buckets[len(bucketBounds)])
+
+	return map[string]interface{}{
+		"count":   count,
+		"mean_ms": mean,
+		"buckets": buckets,
+	}
+}
+
+// Latency and throughput statistics collected across all pipelines: decode and
+// encode timings around graph construction and evaluation, per-operation
+// timings, and counts of processed and shed transformations.
+var stats struct {
+	decode Histogram
+	encode Histogram
+
+	processed uint64 // The total number of transformations processed.
+	busy      uint64 // The number of transformations shed due to a full queue.
+
+	stages map[string]*Histogram // Per-operation timing, indexed on operation name.
+	lock   sync.Mutex            // Used for controlling concurrent access to the stage table.
+}
+
+// Returns the histogram tracking the operation name provided, creating it on
+// first use. The set of names is fixed by the operation list, so the table
+// never grows beyond a handful of entries.
+func stageHistogram(name string) *Histogram {
+	stats.lock.Lock()
+	defer stats.lock.Unlock()
+
+	if h, exists := stats.stages[name]; exists {
+		return h
+	}
+
+	stats.stages[name] = &Histogram{}
+	return stats.stages[name]
+}
+
+// Stats returns a point-in-time snapshot of pipeline statistics: queue depth
+// and throughput for the worker pool, decode, per-operation and encode latency
+// distributions, and memory and operation-cache figures tracked by VIPS.
+func Stats() map[string]interface{} {
+	var mem, high C.size_t
+	var allocs, ops C.int
+	C.ico_stats(&mem, &high, &allocs, &ops)
+
+	stats.lock.Lock()
+	stages := make(map[string]interface{}, len(stats.stages))
+	for name, h := range stats.stages {
+		stages[name] = h.Stats()
+	}
+	stats.lock.Unlock()
+
+	var depth, capacity int
+	if pool.jobs != nil {
+		depth, capacity = len(pool.jobs), cap(pool.jobs)
+	}
+
+	return map[string]interface{}{
+		"queue": map[string]interface{}{
+			"depth":     depth,
+			"capacity":  capacity,
+			"processed": atomic.LoadUint64(&stats.processed),
+			"busy":      atomic.LoadUint64(&stats.busy),
+		},
+		"decode":     stats.decode.Stats(),
+		"encode":     stats.encode.Stats(),
+		"operations": stages,
+		"vips": map[string]interface{}{
+			"memory":            int64(mem),
+			"memory_highwater":  int64(high),
+			"allocations":       int64(allocs),
+			"cached_operations": int64(ops),
+		},
+	}
+}
+
+// Initialize package variables for statistics tracking.
+func init() {
+	stats.stages = make(map[string]*Histogram)
+}
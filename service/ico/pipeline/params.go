@@ -5,8 +5,10 @@ import (
 	"fmt"
 	"reflect"
 	"regexp"
+	"sort"
 	"strconv"
 	"strings"
+	"sync"
 )
 
 // Params represents a list of pipeline parameters, indexed under their unique
@@ -126,7 +128,7 @@ func (p *Params) getFieldValue(f *reflect.Value, t reflect.StructTag) (string, e
 
 		// Validate value if needed.
 		if vr := t.Get("valid"); vr != "" {
-			if ok, _ = regexp.MatchString(vr, vf[i]); !ok {
+			if !validExp(vr).MatchString(vf[i]) {
 				return "", fmt.Errorf("%s: value '%s' does not match '%s'", key[0], vf[i], vr)
 			}
 		}
@@ -137,6 +139,67 @@ func (p *Params) getFieldValue(f *reflect.Value, t reflect.StructTag) (string, e
 	return val, nil
 }
 
+// A cache of compiled validation expressions, as found in `valid` field tags. The set of
+// expressions is small and fixed at compile time, so entries are never evicted.
+var validLock sync.Mutex
+var validCache = make(map[string]*regexp.Regexp)
+
+// Returns the compiled regular expression for the validation pattern provided, compiling and
+// caching it on first use. Validation patterns come from struct tags and are assumed well-formed.
+func validExp(pattern string) *regexp.Regexp {
+	validLock.Lock()
+	defer validLock.Unlock()
+
+	if exp, exists := validCache[pattern]; exists {
+		return exp
+	}
+
+	validCache[pattern] = regexp.MustCompile(pattern)
+	return validCache[pattern]
+}
+
+// A map of parameter default values. Parameters matching their defaults are elided during
+// canonicalization, as their presence does not affect the processed result.
+var paramDefaults = map[string]string{
+	"width":       "0",
+	"height":      "0",
+	"fit":         "clip",
+	"interp":      "bilinear",
+	"quality":     "0",
+	"interlace":   "0",
+	"strip":       "0",
+	"compression": "-1",
+}
+
+// Canonical returns the canonical form of the parameter list provided: parameters are sorted by
+// name and parameters matching their default values are elided, so equivalent parameter lists —
+// which the pipeline treats identically regardless of order — produce the same canonical string.
+// An empty string is returned alongside a nil error if every parameter is elided.
+func Canonical(params string) (string, error) {
+	prm, err := Parse(params)
+	if err != nil {
+		return "", err
+	}
+
+	keys := make([]string, 0, len(*prm))
+	for k, v := range *prm {
+		if def, exists := paramDefaults[k]; exists && def == v {
+			continue
+		}
+
+		keys = append(keys, k)
+	}
+
+	sort.Strings(keys)
+
+	fields := make([]string, len(keys))
+	for i, k := range keys {
+		fields[i] = k + "=" + (*prm)[k]
+	}
+
+	return strings.Join(fields, ","), nil
+}
+
 // Parse slices the parameter string provided and returns a Params instance,
 // allowing for processing on individual parameters. Returns an error if parsing
 // fails for any reason.
@@ -10,30 +10,108 @@ int ico_init() {
 		return 1;
 	}
 
-	vips_concurrency_set(1);
 	vips_cache_set_max_mem(1024 * 1024 * 128); // 128MB
 	vips_cache_set_max(256);                   // 256 operations
 
+	// Enable SIMD paths for convolution and interpolation, keeping the more
+	// expensive resampling kernels competitive with bilinear in throughput.
+	vips_vector_set_enabled(1);
+
 	return 0;
 }
 
+// Set the number of worker threads used for evaluating operation graphs. A
+// value of zero or less restores the VIPS default, which is the number of
+// processors available. The worker pool is shared process-wide; small images
+// produce few work units and so never occupy the full pool, while large
+// images can fan out across all configured threads.
+void ico_concurrency(int threads) {
+	vips_concurrency_set(threads > 0 ? threads : 0);
+}
+
 const char *ico_error() {
 	return vips_error_buffer();
 }
 
-ico_image *ico_image_new(const void *data, size_t len, int type) {
+// Report memory and operation-cache statistics tracked by VIPS: bytes of
+// pixel buffer memory currently held and the high-water mark for the same,
+// the number of tracked allocations, and the number of operations held in
+// the shared operation cache.
+void ico_stats(size_t *mem, size_t *mem_high, int *allocs, int *ops) {
+	*mem = vips_tracked_get_mem();
+	*mem_high = vips_tracked_get_mem_highwater();
+	*allocs = vips_tracked_get_allocs();
+	*ops = vips_cache_get_size();
+}
+
+// A small freelist of image structures, reused across requests in order to
+// avoid a malloc/free pair per processed image.
+#define IMAGE_POOL_SIZE 64
+
+static ico_image *image_pool[IMAGE_POOL_SIZE];
+static int image_pool_len = 0;
+static GMutex image_pool_lock;
+
+static ico_image *image_alloc() {
+	ico_image *img = NULL;
+
+	g_mutex_lock(&image_pool_lock);
+	if (image_pool_len > 0) {
+		img = image_pool[--image_pool_len];
+	}
+	g_mutex_unlock(&image_pool_lock);
+
+	return img != NULL ? img : malloc(sizeof(ico_image));
+}
+
+static void image_free(ico_image *img) {
+	g_mutex_lock(&image_pool_lock);
+	if (image_pool_len < IMAGE_POOL_SIZE) {
+		image_pool[image_pool_len++] = img;
+		img = NULL;
+	}
+	g_mutex_unlock(&image_pool_lock);
+
+	if (img != NULL) {
+		free(img);
+	}
+}
+
+ico_image *ico_image_new(const void *data, size_t len, int type, int sequential, int animated) {
 	ico_image *img;
+	int access = sequential ? VIPS_ACCESS_SEQUENTIAL : VIPS_ACCESS_RANDOM;
 
-	// Allocate initial image structure.
-	img = malloc(sizeof(ico_image));
+	// Allocate initial image structure, reusing a pooled one if available.
+	img = image_alloc();
 	if (img == NULL) {
 		vips_error("pipeline", "%s", "failed to allocate memory for Ico image");
 		errno = 1;
 		return NULL;
 	}
 
-	// Attempt to load internal representation of image from buffer via VIPS.
-	img->internal = vips_image_new_from_buffer(data, len, "", NULL);
+	// Attempt to load internal representation of image from buffer via VIPS. If
+	// the operation graph is known to read pixels strictly top-to-bottom, the
+	// image is opened for sequential access, letting decode, processing and
+	// encode overlap in a single streaming pass instead of decoding the full
+	// raster to memory up-front.
+	//
+	// GIF images are only decoded in full when the output preserves animation;
+	// otherwise the first frame alone is loaded, which keeps static previews of
+	// large animations cheap.
+	if (type == TYPE_GIF && animated) {
+		VipsImage *tmp = NULL;
+		if (vips_gifload_buffer((void *) data, len, &tmp,
+			"n", -1, "access", access, NULL) != 0) {
+			errno = 1;
+			return NULL;
+		}
+
+		img->internal = tmp;
+	} else {
+		img->internal = vips_image_new_from_buffer(data, len, "",
+			"access", access, NULL);
+	}
+
 	if (img->internal == NULL) {
 		errno = 1;
 		return NULL;
@@ -42,26 +120,79 @@ ico_image *ico_image_new(const void *data, size_t len, int type) {
 	img->data.buffer = data;
 	img->data.len = len;
 	img->type = type;
+	img->sequential = sequential;
+	img->animated = animated;
+
+	// Encoder options default to values matching the VIPS save defaults.
+	img->encode.quality = 0;
+	img->encode.compression = -1;
+	img->encode.interlace = 0;
+	img->encode.strip = 0;
 
 	errno = 0;
 	return img;
 }
 
+// Read the dimensions for the image contained in the buffer provided, decoding
+// the header alone. Returns non-zero if the buffer cannot be read as an image.
+int ico_image_size(const void *data, size_t len, int *width, int *height) {
+	VipsImage *tmp = vips_image_new_from_buffer(data, len, "", NULL);
+	if (tmp == NULL) {
+		return -1;
+	}
+
+	*width = vips_image_get_width(tmp);
+	*height = vips_image_get_height(tmp);
+
+	g_object_unref(tmp);
+	return 0;
+}
+
+// Append an operation result to the image's lazy operation graph. The new head
+// holds a reference to the previous one, so no pixels are computed here; the
+// accumulated graph is evaluated in a single pass by `ico_image_write`.
+void ico_image_chain(ico_image *img, VipsImage *next) {
+	g_object_unref(img->internal);
+	img->internal = next;
+}
+
+// Evaluate the image's operation graph and encode the result into a buffer.
+// This is the only point in the pipeline where pixels are computed, allowing
+// VIPS to fuse all chained operations into a single pass over the image.
 void ico_image_write(ico_image *img, void **buf, size_t *len) {
 	int result;
 
+	// Resolve encoder options, falling back to the VIPS defaults for each
+	// format when left unset by the pipeline.
+	int quality = img->encode.quality;
+	int compression = img->encode.compression >= 0 ? img->encode.compression : 6;
+	int interlace = img->encode.interlace ? 1 : 0;
+	int strip = img->encode.strip ? 1 : 0;
+
 	// Determine image type to write.
 	switch (img->type) {
 	case TYPE_JPEG:
-		result = vips_jpegsave_buffer(img->internal, buf, len, NULL);
+		result = vips_jpegsave_buffer(img->internal, buf, len,
+			"Q", quality > 0 ? quality : 75,
+			"interlace", interlace, "strip", strip, NULL);
 		break;
 	case TYPE_PNG:
-		result = vips_pngsave_buffer(img->internal, buf, len, NULL);
+		result = vips_pngsave_buffer(img->internal, buf, len,
+			"compression", compression,
+			"interlace", interlace, "strip", strip, NULL);
 		break;
 	case TYPE_GIF:
-		// Saving to GIF not supported yet.
-		errno = 1;
-		return;
+		result = vips_gifsave_buffer(img->internal, buf, len, NULL);
+		break;
+	case TYPE_WEBP:
+		result = vips_webpsave_buffer(img->internal, buf, len,
+			"Q", quality > 0 ? quality : 75, "strip", strip, NULL);
+		break;
+	case TYPE_AVIF:
+		result = vips_heifsave_buffer(img->internal, buf, len,
+			"Q", quality > 0 ? quality : 50,
+			"compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1, NULL);
+		break;
 	}
 
 	// Check for possible error during processing.
@@ -76,7 +207,7 @@ void ico_image_write(ico_image *img, void **buf, size_t *len) {
 
 void ico_image_destroy(ico_image *img) {
 	g_object_unref(img->internal);
-	free(img);
+	image_free(img);
 }
 
 int ico_image_width(ico_image *img) {
@@ -86,3 +217,22 @@ int ico_image_width(ico_image *img) {
 int ico_image_height(ico_image *img) {
 	return vips_image_get_height(img->internal);
 }
+
+int ico_image_type(ico_image *img) {
+	return img->type;
+}
+
+// Set the format the image will be encoded to by `ico_image_write`. This has
+// no effect on the operation graph itself, only on the save branch chosen.
+void ico_image_format(ico_image *img, int type) {
+	img->type = type;
+}
+
+// Set encoder options used by `ico_image_write`. A quality of zero and a
+// compression of less than zero fall back to the format's default values.
+void ico_image_encode(ico_image *img, int quality, int compression, int interlace, int strip) {
+	img->encode.quality = quality;
+	img->encode.compression = compression;
+	img->encode.interlace = interlace;
+	img->encode.strip = strip;
+}
@@ -11,8 +11,12 @@ import "C"
 
 import (
 	// Standard library.
+	"container/list"
 	"fmt"
 	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
 	"unsafe"
 
 	// Internal packages.
@@ -24,65 +28,312 @@ import (
 // image are guaranteed to be deterministic.
 type Operation interface {
 	Process(*C.ico_image) error
+
+	// Name returns a short, stable name for the operation, used for indexing
+	// per-operation statistics.
+	Name() string
+
+	// Sequential returns true if the operation reads source pixels strictly
+	// top-to-bottom, allowing the image to be streamed rather than decoded to
+	// memory in full.
+	Sequential() bool
+
+	// Animated returns true if the operation can be applied across all frames
+	// of a multi-frame image. Pipelines containing operations that cannot will
+	// load the first frame only.
+	Animated() bool
+
+	// Noop returns true if the operation would leave an image of the given
+	// type and dimensions unchanged.
+	Noop(kind image.Kind, width, height int64) bool
+
+	// Bounds returns the image type and dimensions that would result from
+	// applying the operation to an image of the given type and dimensions,
+	// as computed from header metadata alone.
+	Bounds(kind image.Kind, width, height int64) (image.Kind, int64, int64)
 }
 
 // An ordered list of all possible operations in a pipeline.
 var operations = []func(*Params) (Operation, error){
 	NewResize,
+	NewFormat,
 }
 
 // A Pipeline represents all data required for converting an image from its
 // original format to the processed result.
 type Pipeline struct {
 	operations []Operation
+	sequential bool
+	animated   bool
+}
+
+// ErrBusy is returned when the processing queue is full and no more requests
+// can be admitted. Callers are expected to shed load and have the user retry.
+var ErrBusy = fmt.Errorf("image processing queue is full")
+
+// A job represents a single image transformation submitted to the worker pool,
+// along with a channel on which the result is delivered.
+type job struct {
+	pipeline *Pipeline
+	img      *image.Image
+	result   chan error
+}
+
+// The shared worker pool used for all image processing. Workers are pinned to
+// OS threads, bounding both the number of concurrent cgo calls into VIPS and
+// the number of images decoded at any one time.
+var pool struct {
+	jobs  chan *job
+	setup sync.Once
+}
+
+// Start initializes the processing worker pool with the given number of
+// workers and queue slots. Zero or negative values default to the number of
+// processors available and four queue slots per worker respectively. The pool
+// is only initialized once; subsequent calls have no effect.
+func Start(workers, queue int64) {
+	pool.setup.Do(func() {
+		if workers <= 0 {
+			workers = int64(runtime.NumCPU())
+		}
+
+		if queue <= 0 {
+			queue = workers * 4
+		}
+
+		pool.jobs = make(chan *job, queue)
+		for i := int64(0); i < workers; i++ {
+			go worker()
+		}
+	})
+}
+
+// Consumes and processes jobs from the submission queue. Each worker is pinned
+// to an OS thread for the duration of its lifetime, keeping cgo calls into
+// VIPS on a fixed set of threads.
+func worker() {
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	for j := range pool.jobs {
+		j.result <- j.pipeline.run(j.img)
+	}
 }
 
 // Process applies the set of operations defined for the pipeline against the
-// provided image data. An error is returned if processing fails at any point,
-// otherwise the image provided is modified in-place and nil is returned.
+// provided image data, by submitting the transformation to the shared worker
+// pool. An ErrBusy error is returned without blocking if the submission queue
+// is full, otherwise processing errors, if any, are returned as-is.
 func (p *Pipeline) Process(img *image.Image) error {
-	// Initialize internal image representation.
-	ptr, err := C.ico_image_new(unsafe.Pointer(&img.Data[0]), C.size_t(img.Size), C.int(img.Type))
+	// Initialize worker pool with default sizes, if not already started.
+	Start(0, 0)
+
+	j := &job{pipeline: p, img: img, result: make(chan error, 1)}
+
+	select {
+	case pool.jobs <- j:
+	default:
+		atomic.AddUint64(&stats.busy, 1)
+		return ErrBusy
+	}
+
+	return <-j.result
+}
+
+// Applies the set of operations defined for the pipeline against the provided
+// image data. An error is returned if processing fails at any point, otherwise
+// the image provided is modified in-place and nil is returned.
+func (p *Pipeline) run(img *image.Image) error {
+	// Open images for sequential access if all operations in the pipeline are
+	// known to read pixels in top-to-bottom order, and preserve animation only
+	// if all operations can process multi-frame images.
+	var seq, anim C.int
+	if p.sequential {
+		seq = 1
+	}
+	if p.animated {
+		anim = 1
+	}
+
+	// Initialize internal image representation, recording time spent opening
+	// the image. Decoding is deferred to graph evaluation at write time, so
+	// this covers header parsing alone.
+	start := time.Now()
+	ptr, err := C.ico_image_new(unsafe.Pointer(&img.Data[0]), C.size_t(img.Size), C.int(img.Type), seq, anim)
+	stats.decode.Observe(time.Since(start))
+
 	if err != nil {
 		return fmt.Errorf("failed to initialize image for pipeline: %s", p.Error())
 	}
 
-	// Apply ordered list of operations in turn.
+	// Apply ordered list of operations in turn, recording time spent in each.
 	for _, op := range p.operations {
-		if err = op.Process(ptr); err != nil {
+		start = time.Now()
+		err = op.Process(ptr)
+		stageHistogram(op.Name()).Observe(time.Since(start))
+
+		if err != nil {
 			return err
 		}
 	}
 
-	// Write internal image representation to buffer.
+	// Write internal image representation to buffer, recording time spent
+	// evaluating the operation graph and encoding the result.
 	var buf unsafe.Pointer
 	var len C.size_t
 
-	if _, err = C.ico_image_write(ptr, &buf, &len); err != nil {
+	start = time.Now()
+	_, err = C.ico_image_write(ptr, &buf, &len)
+	stats.encode.Observe(time.Since(start))
+
+	if err != nil {
 		return fmt.Errorf("failed to write to image: %s", p.Error())
 	}
 
-	// Copy internal buffer to byte slice.
-	img.Data = C.GoBytes(buf, C.int(len))
-	img.Size = int64(len)
+	atomic.AddUint64(&stats.processed, 1)
 
-	// Clean up references to internal buffers.
+	// Clean up references to internal image structures before releasing the
+	// source buffer, which the operation graph may still reference. The final
+	// image type is read out first, as it may have been modified by a format
+	// conversion operation.
+	kind := image.Kind(C.ico_image_type(ptr))
 	C.ico_image_destroy(ptr)
-	C.g_free(buf)
+
+	// Release the buffer backing the source image, if it carries a release
+	// hook, e.g. for originals served as memory mappings of cached files.
+	img.Release()
+
+	// Hand the encoded buffer over to Go without copying. The buffer remains
+	// owned by VIPS and is released via a finalizer once the image becomes
+	// unreachable, so consumers must keep the image alive for as long as they
+	// reference its data.
+	img.Data = unsafe.Slice((*byte)(buf), int(len))
+	img.Size = int64(len)
+	img.Type = kind
+	img.Free = func() { C.g_free(buf) }
+
+	runtime.SetFinalizer(img, (*image.Image).Release)
 
 	return nil
 }
 
+// Noop returns true if processing the image provided would leave it unchanged,
+// as determined from the image header alone, without decoding any pixels.
+// Callers can use this to serve the original buffer as-is, skipping the decode
+// and re-encode cycle entirely.
+func (p *Pipeline) Noop(img *image.Image) bool {
+	if len(p.operations) == 0 {
+		return true
+	}
+
+	// Read image dimensions from the header alone.
+	var w, h C.int
+	if C.ico_image_size(unsafe.Pointer(&img.Data[0]), C.size_t(img.Size), &w, &h) != 0 {
+		return false
+	}
+
+	for _, op := range p.operations {
+		if !op.Noop(img.Type, int64(w), int64(h)) {
+			return false
+		}
+	}
+
+	return true
+}
+
+// Stat returns the image type and dimensions that would result from processing
+// the image provided, as determined from the image header alone, without
+// decoding any pixels or running the pipeline.
+func (p *Pipeline) Stat(img *image.Image) (image.Kind, int64, int64, error) {
+	// Read image dimensions from the header alone.
+	var w, h C.int
+	if C.ico_image_size(unsafe.Pointer(&img.Data[0]), C.size_t(img.Size), &w, &h) != 0 {
+		return 0, 0, 0, fmt.Errorf("failed to read image header: %s", p.Error())
+	}
+
+	kind, width, height := img.Type, int64(w), int64(h)
+	for _, op := range p.operations {
+		kind, width, height = op.Bounds(kind, width, height)
+	}
+
+	return kind, width, height, nil
+}
+
+// SetConcurrency sets the number of threads used for processing images across
+// all pipelines. A value of zero or less falls back to the VIPS default, which
+// is the number of processors available on the host.
+func SetConcurrency(threads int64) {
+	C.ico_concurrency(C.int(threads))
+}
+
 // Error returns the last error generated by the pipeline, if any.
 func (p *Pipeline) Error() error {
 	return fmt.Errorf("%s", C.GoString(C.ico_error()))
 }
 
-// New parses the parameter list provided and initializes a Pipeline and
-// supporting list of Operations stored within.
+// The maximum number of compiled pipelines kept in cache. The parameter vocabulary in a typical
+// deployment is small, so this is effectively unbounded in practice.
+const pipelineCacheSize = 512
+
+// A least-recently-used cache of compiled pipelines, keyed on their parameter strings. Compiled
+// pipelines are immutable and safe for concurrent use, so cache hits skip parameter parsing and
+// reflection-driven unpacking entirely.
+var pipelineCache struct {
+	order *list.List
+	cache map[string]*list.Element
+
+	sync.Mutex
+}
+
+// An element in the compiled-pipeline cache, pairing a pipeline with its parameter string.
+type compiled struct {
+	params   string
+	pipeline *Pipeline
+}
+
+// New returns a Pipeline for the parameter list provided, compiling and caching it on first use.
+// Compiled pipelines are shared between requests, and go straight to processing on cache hits.
 func New(params string) (*Pipeline, error) {
-	// Initialize and prepare pipeline.
-	p := &Pipeline{operations: make([]Operation, 0)}
+	pipelineCache.Lock()
+	if el, exists := pipelineCache.cache[params]; exists {
+		pipelineCache.order.MoveToFront(el)
+		pipelineCache.Unlock()
+		return el.Value.(*compiled).pipeline, nil
+	}
+	pipelineCache.Unlock()
+
+	p, err := compile(params)
+	if err != nil {
+		return nil, err
+	}
+
+	pipelineCache.Lock()
+	defer pipelineCache.Unlock()
+
+	// Check for concurrent insertion of the same parameter string, and evict the least recently
+	// used pipeline if the cache has grown beyond bounds.
+	if el, exists := pipelineCache.cache[params]; exists {
+		return el.Value.(*compiled).pipeline, nil
+	}
+
+	pipelineCache.cache[params] = pipelineCache.order.PushFront(&compiled{params, p})
+
+	if pipelineCache.order.Len() > pipelineCacheSize {
+		el := pipelineCache.order.Back()
+		delete(pipelineCache.cache, el.Value.(*compiled).params)
+		pipelineCache.order.Remove(el)
+	}
+
+	return p, nil
+}
+
+// Parses the parameter list provided and initializes a Pipeline and supporting
+// list of Operations stored within.
+func compile(params string) (*Pipeline, error) {
+	// Initialize and prepare pipeline. Pipelines are assumed to be streamable
+	// and animation-preserving until an operation without those properties is
+	// appended.
+	p := &Pipeline{operations: make([]Operation, 0), sequential: true, animated: true}
 
 	// Prepare parameter list for distribution amongst operations.
 	prm, err := Parse(params)
@@ -104,6 +355,8 @@ func New(params string) (*Pipeline, error) {
 		}
 
 		p.operations = append(p.operations, op)
+		p.sequential = p.sequential && op.Sequential()
+		p.animated = p.animated && op.Animated()
 	}
 
 	return p, nil
@@ -117,4 +370,7 @@ func init() {
 	if ok := C.ico_init(); ok != 0 {
 		panic("failed to initialize VIPS library")
 	}
+
+	pipelineCache.order = list.New()
+	pipelineCache.cache = make(map[string]*list.Element)
 }
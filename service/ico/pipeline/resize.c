@@ -6,6 +6,55 @@
 #include "pipeline.h"
 #include "resize.h"
 
+// Returns the largest shrink factor the image's codec can apply during load
+// for the resize factor requested, or 1 for formats with no reduced-resolution
+// decode mode. JPEG and WebP decoders can emit a raster at 1/2, 1/4 or 1/8
+// scale; PNG offers no such mode and is shrunk after a full decode.
+static int load_shrink_factor(ico_image *img, double factor) {
+	switch (img->type) {
+	case TYPE_JPEG:
+	case TYPE_WEBP:
+		if (factor >= 8) {
+			return 8;
+		} else if (factor >= 4) {
+			return 4;
+		}
+
+		return 2;
+	}
+
+	return 1;
+}
+
+// Re-opens the image's source buffer at a reduced resolution, replacing the
+// head of the operation graph. The buffer is re-opened with the same access
+// mode it was originally loaded with, so streaming pipelines remain streaming.
+static int load_shrunk(ico_image *img, int shrink) {
+	VipsImage *tmp = NULL;
+
+	void *buf = (void *) img->data.buffer;
+	size_t len = img->data.len;
+	int access = img->sequential ? VIPS_ACCESS_SEQUENTIAL : VIPS_ACCESS_RANDOM;
+
+	switch (img->type) {
+	case TYPE_JPEG:
+		if (vips_jpegload_buffer(buf, len, &tmp, "shrink", shrink, "access", access, NULL) != 0) {
+			return -1;
+		}
+		break;
+	case TYPE_WEBP:
+		if (vips_webpload_buffer(buf, len, &tmp, "shrink", shrink, "access", access, NULL) != 0) {
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	ico_image_chain(img, tmp);
+	return 0;
+}
+
 void ico_image_shrink(ico_image *img, double factor) {
 	// Return without shrinking if factor is less than 2.
 	if (factor < 2) {
@@ -13,29 +62,16 @@ void ico_image_shrink(ico_image *img, double factor) {
 		return;
 	}
 
-	// JPEG images support a shrink-on-load operation, which is much more efficient
-	// than generating a full-size image and shrinking afterwards.
-	if (img->type == TYPE_JPEG) {
-		int shrink = 2;
-		VipsImage *tmp = NULL;
-
-		if (factor >= 8) {
-			shrink = 8;
-		} else if (factor >= 4) {
-			shrink = 4;
-		}
-
-		void *buf = (void *) img->data.buffer;
-		size_t len = img->data.len;
-
-		if (vips_jpegload_buffer(buf, len, &tmp, "shrink", shrink, NULL) != 0) {
+	// Formats with a reduced-resolution decode mode are re-opened at the largest
+	// shrink the codec offers, which is much more efficient than generating a
+	// full-size image and shrinking afterwards.
+	int shrink = load_shrink_factor(img, factor);
+	if (shrink > 1) {
+		if (load_shrunk(img, shrink) != 0) {
 			errno = 1;
 			return;
 		}
 
-		g_object_unref(img->internal);
-		img->internal = tmp;
-
 		// Recalculate resize factor for shrunk image and return early if there
 		// is no further processing required.
 		factor = factor / shrink;
@@ -45,7 +81,8 @@ void ico_image_shrink(ico_image *img, double factor) {
 		}
 	}
 
-	// Shrink image by integer factor.
+	// Append an integer-factor shrink to the operation graph. No pixels are
+	// computed here; the shrink is fused with its neighbours at write time.
 	VipsImage *tmp = NULL;
 
 	if (vips_shrink(img->internal, &tmp, floor(factor), floor(factor), NULL) != 0) {
@@ -53,26 +90,64 @@ void ico_image_shrink(ico_image *img, double factor) {
 		return;
 	}
 
-	g_object_unref(img->internal);
-	img->internal = tmp;
+	ico_image_chain(img, tmp);
 
 	errno = 0;
 	return;
 }
 
-void ico_image_affine(ico_image *img, double factor) {
+void ico_image_affine(ico_image *img, double factor, int interp) {
 	VipsImage *tmp = NULL;
 	double residual = floor(factor) / factor;
 
-	// Resize image by the residual factor. By default, uses a bilinear interpolator
-	// for blending.
-	if (vips_affine(img->internal, &tmp, residual, 0, 0, residual, NULL) != 0) {
+	// Lanczos3 is offered by VIPS as a reduce kernel rather than an affine
+	// interpolator, so reductions using it take a separate path. Both append
+	// a resize by the residual factor to the operation graph.
+	if (interp == INTERP_LANCZOS3) {
+		if (vips_reduce(img->internal, &tmp, 1 / residual, 1 / residual,
+			"kernel", VIPS_KERNEL_LANCZOS3, NULL) != 0) {
+			errno = 1;
+			return;
+		}
+	} else {
+		VipsInterpolate *in = vips_interpolate_new(interp == INTERP_BICUBIC ? "bicubic" : "bilinear");
+		if (in == NULL) {
+			errno = 1;
+			return;
+		}
+
+		if (vips_affine(img->internal, &tmp, residual, 0, 0, residual, "interpolate", in, NULL) != 0) {
+			g_object_unref(in);
+			errno = 1;
+			return;
+		}
+
+		g_object_unref(in);
+	}
+
+	ico_image_chain(img, tmp);
+
+	errno = 0;
+	return;
+}
+
+void ico_image_thumbnail(ico_image *img, int width, int height, int crop) {
+	VipsImage *tmp = NULL;
+
+	void *buf = (void *) img->data.buffer;
+	size_t len = img->data.len;
+
+	// Produce a thumbnail directly from the source buffer, fusing load-time
+	// shrink, residual resize and any centered crop into a single operation.
+	// Images are never enlarged, matching the behaviour of the multi-step path.
+	if (vips_thumbnail_buffer(buf, len, &tmp, width,
+		"height", height, "size", VIPS_SIZE_DOWN,
+		"crop", crop ? VIPS_INTERESTING_CENTRE : VIPS_INTERESTING_NONE, NULL) != 0) {
 		errno = 1;
 		return;
 	}
 
-	g_object_unref(img->internal);
-	img->internal = tmp;
+	ico_image_chain(img, tmp);
 
 	errno = 0;
 	return;
@@ -81,15 +156,14 @@ void ico_image_affine(ico_image *img, double factor) {
 void ico_image_crop(ico_image *img, int x, int y, int w, int h) {
 	VipsImage *tmp = NULL;
 
-	// Resize image by the residual factor. By default, uses a bilinear interpolator
-	// for blending.
+	// Append an area extraction to the operation graph, cropping the image to
+	// the bounds provided once the graph is evaluated.
 	if (vips_extract_area(img->internal, &tmp, x, y, w, h, NULL) != 0) {
 		errno = 1;
 		return;
 	}
 
-	g_object_unref(img->internal);
-	img->internal = tmp;
+	ico_image_chain(img, tmp);
 
 	errno = 0;
 	return;
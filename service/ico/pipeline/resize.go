@@ -15,13 +15,17 @@ import (
 	// Standard library.
 	"fmt"
 	"math"
+
+	// Internal packages.
+	"github.com/deuill/mash/service/ico/image"
 )
 
 // Resize is an operation for manipulating image dimensions, including clipping,
 // cropping and focusing within images.
 type Resize struct {
-	Width  int64 `key:"width"`
-	Height int64 `key:"height"`
+	Width  int64  `key:"width"`
+	Height int64  `key:"height"`
+	Interp string `key:"interp" default:"bilinear" valid:"bilinear|bicubic|lanczos3"`
 	Fit    struct {
 		Kind string `key:"fit" default:"clip" valid:"crop"`
 		Crop struct {
@@ -44,8 +48,34 @@ func (r *Resize) Process(img *C.ico_image) error {
 		return nil
 	}
 
-	// Get base resize factor for resulting image.
+	// Route plain clip resizes and centered crops, which make up the vast
+	// majority of requests, through the fused thumbnail path, performing
+	// load-time shrink, residual resize and crop as a single operation.
+	if r.fused() {
+		width, height := r.Width, r.Height
+		if width == 0 {
+			width = maxDimension
+		}
+		if height == 0 {
+			height = maxDimension
+		}
+
+		var crop C.int
+		if r.Fit.Kind == "crop" {
+			crop = 1
+		}
+
+		if _, err := C.ico_image_thumbnail(img, C.int(width), C.int(height), crop); err != nil {
+			return fmt.Errorf("failed to thumbnail image")
+		}
+
+		return nil
+	}
+
+	// Get base resize factor for resulting image. The crop focus point is tracked locally, as
+	// operations are shared between concurrent requests and must not be mutated here.
 	factor := r.resizeFactor(img)
+	px, py := r.Fit.Crop.Point.X, r.Fit.Crop.Point.Y
 
 	// Shrink image by integer factor, if needed.
 	if factor >= 2 {
@@ -54,7 +84,7 @@ func (r *Resize) Process(img *C.ico_image) error {
 		}
 
 		// Recalculate crop point for shrunk image.
-		r.Fit.Crop.Point.X, r.Fit.Crop.Point.Y = r.cropPoint(factor)
+		px, py = cropPoint(px, py, factor)
 
 		// Recalculate resize factor for shrunk image.
 		factor = r.resizeFactor(img)
@@ -62,19 +92,19 @@ func (r *Resize) Process(img *C.ico_image) error {
 
 	// Resize image by remaining factor, if any.
 	if factor > 1 {
-		if _, err := C.ico_image_affine(img, C.double(factor)); err != nil {
+		if _, err := C.ico_image_affine(img, C.double(factor), interpTypeLookup[r.Interp]); err != nil {
 			return fmt.Errorf("failed to affine resize image")
 		}
 
 		// Recalculate crop point for resized image.
-		r.Fit.Crop.Point.X, r.Fit.Crop.Point.Y = r.cropPoint(factor)
+		px, py = cropPoint(px, py, factor)
 	}
 
 	// Apply specified fit mode
 	switch r.Fit.Kind {
 	case "crop":
 		w, h := int64(C.ico_image_width(img)), int64(C.ico_image_height(img))
-		bx, by, bw, bh := r.cropBounds(img)
+		bx, by, bw, bh := r.cropBounds(img, px, py)
 
 		// Do not crop image if crop boundaries are same as image size.
 		if bx == 0 && by == 0 && bw == w && bh == h {
@@ -90,12 +120,98 @@ func (r *Resize) Process(img *C.ico_image) error {
 	return nil
 }
 
+// The maximum dimension accepted for processed images, substituted for
+// unconstrained axes when building thumbnails.
+const maxDimension = 1 << 24
+
+// A lookup table of interpolator names against internal pipeline types.
+var interpTypeLookup = map[string]C.int{
+	"bilinear": C.INTERP_BILINEAR,
+	"bicubic":  C.INTERP_BICUBIC,
+	"lanczos3": C.INTERP_LANCZOS3,
+}
+
+// Returns true if the operation can be handled by the fused thumbnail path,
+// which covers plain clip resizes and crops centered on the image. Other crop
+// gravities, and requests for a specific interpolator, require the multi-step
+// path and its explicit resize calls.
+func (r *Resize) fused() bool {
+	if r.Interp != "bilinear" {
+		return false
+	}
+
+	switch r.Fit.Kind {
+	case "crop":
+		return r.Fit.Crop.Gravity == "center" && r.Width > 0 && r.Height > 0
+	}
+
+	return true
+}
+
+// Name returns the name this operation is tracked under in statistics.
+func (r *Resize) Name() string {
+	return "resize"
+}
+
+// Sequential returns true for pure downscale requests, which read source
+// pixels in top-to-bottom order. Cropping may need to seek backwards into the
+// source and requires random access.
+func (r *Resize) Sequential() bool {
+	return r.Fit.Kind != "crop"
+}
+
+// Animated returns false, as resizing operates on a single frame; animated
+// sources are reduced to a static preview of their first frame.
+func (r *Resize) Animated() bool {
+	return false
+}
+
+// Noop returns true if the requested dimensions match or exceed those of the
+// image, mirroring the skip condition applied during processing.
+func (r *Resize) Noop(kind image.Kind, width, height int64) bool {
+	return (r.Width > width || r.Height > height) || (r.Width == width && r.Height == height)
+}
+
+// Bounds returns the dimensions that would result from applying the resize to
+// an image of the given dimensions, mirroring the arithmetic applied during
+// processing without touching any pixels. The image type is passed through.
+func (r *Resize) Bounds(kind image.Kind, width, height int64) (image.Kind, int64, int64) {
+	if r.Noop(kind, width, height) {
+		return kind, width, height
+	}
+
+	factor := r.factor(width, height)
+	if factor <= 1 {
+		return kind, width, height
+	}
+
+	// Crops produce the requested dimensions exactly, with unset axes scaled
+	// as for clipped resizes.
+	w := int64(math.Round(float64(width) / factor))
+	h := int64(math.Round(float64(height) / factor))
+
+	if r.Fit.Kind == "crop" {
+		if r.Width > 0 {
+			w = r.Width
+		}
+		if r.Height > 0 {
+			h = r.Height
+		}
+	}
+
+	return kind, w, h
+}
+
+// Returns the resize factor for the image provided, based on its current size.
+func (r *Resize) resizeFactor(img *C.ico_image) float64 {
+	return r.factor(int64(C.ico_image_width(img)), int64(C.ico_image_height(img)))
+}
+
 // Returns the resize factor (the difference between image size and requested
 // final size) as a floating point number. For example, requesting a 500x500
 // crop of a 1000x1000 image would return a factor of 2.
-func (r *Resize) resizeFactor(img *C.ico_image) float64 {
+func (r *Resize) factor(w, h int64) float64 {
 	var factor float64
-	w, h := int64(C.ico_image_width(img)), int64(C.ico_image_height(img))
 
 	// Calculate resize factor based on pipeline parameters.
 	switch {
@@ -121,14 +237,14 @@ func (r *Resize) resizeFactor(img *C.ico_image) float64 {
 	return factor
 }
 
-// Returns the pre-defined center of gravity as a pair of X/Y coordinates.
-func (r *Resize) cropPoint(factor float64) (int64, int64) {
-	x, y := r.Fit.Crop.Point.X, r.Fit.Crop.Point.Y
+// Returns the center of gravity provided, scaled down by the given factor.
+func cropPoint(x, y int64, factor float64) (int64, int64) {
 	return int64(float64(x) / factor), int64(float64(y) / factor)
 }
 
-// Returns the boundaries for the area to extract from the provided image.
-func (r *Resize) cropBounds(img *C.ico_image) (int64, int64, int64, int64) {
+// Returns the boundaries for the area to extract from the provided image, for the center of
+// gravity passed in.
+func (r *Resize) cropBounds(img *C.ico_image, px, py int64) (int64, int64, int64, int64) {
 	var x, y int64
 	w, h := int64(C.ico_image_width(img)), int64(C.ico_image_height(img))
 
@@ -137,8 +253,8 @@ func (r *Resize) cropBounds(img *C.ico_image) (int64, int64, int64, int64) {
 	case "point":
 		// Set X and Y coordinates for bounding box, based on the pre-defined
 		// center point, and modify the box for image constraints.
-		x = ((r.Fit.Crop.Point.X) - (r.Width / 2))
-		y = ((r.Fit.Crop.Point.Y) - (r.Height / 2))
+		x = (px - (r.Width / 2))
+		y = (py - (r.Height / 2))
 
 		x = int64(math.Min(math.Max(0, float64(x)), float64((w - r.Width))))
 		y = int64(math.Min(math.Max(0, float64(y)), float64((h - r.Height))))
@@ -0,0 +1,95 @@
+package ico
+
+import (
+	// Standard library
+	"path"
+	"sync/atomic"
+)
+
+// Sizing for the background purge queue, used by the fast-acknowledge purge mode.
+const (
+	purgeWorkers = 4
+	purgeQueue   = 256
+)
+
+// A purge represents a pending invalidation of an original image and all of its processed
+// variants.
+type purge struct {
+	src  *Source
+	name string
+}
+
+// Purger implements a bounded background queue for purge requests, allowing bulk invalidations to
+// be acknowledged immediately rather than holding a request slot for the duration of the S3 list
+// and delete fan-out.
+type Purger struct {
+	queue   chan *purge
+	dropped int64 // The number of purges refused on a full queue, or failed while processing.
+}
+
+// NewPurger initializes a background purger along with its worker pool.
+func NewPurger() *Purger {
+	p := &Purger{
+		queue: make(chan *purge, purgeQueue),
+	}
+
+	for i := 0; i < purgeWorkers; i++ {
+		go p.worker()
+	}
+
+	return p
+}
+
+// Enqueue schedules a purge of the image under the given name and all of its processed variants.
+// Returns false without blocking if the queue is full, letting callers shed load; a refused purge
+// must be retried by the client, as dropping it silently would leave stale variants in place.
+func (p *Purger) Enqueue(src *Source, name string) bool {
+	select {
+	case p.queue <- &purge{src: src, name: name}:
+		return true
+	default:
+		atomic.AddInt64(&p.dropped, 1)
+		return false
+	}
+}
+
+// Depth returns the number of purges currently queued, and Dropped the total number of purges
+// refused or failed since startup, for use in monitoring.
+func (p *Purger) Depth() int64 {
+	return int64(len(p.queue))
+}
+
+func (p *Purger) Dropped() int64 {
+	return atomic.LoadInt64(&p.dropped)
+}
+
+// Consumes and performs purges from the queue. Failures are counted as dropped; the affected
+// variants remain purgeable by a repeat request.
+func (p *Purger) worker() {
+	for pg := range p.queue {
+		if err := purgeImage(pg.src, pg.name); err != nil {
+			atomic.AddInt64(&p.dropped, 1)
+		}
+	}
+}
+
+// Removes the original image under the path provided, along with any processed variants stored
+// alongside it, from local caches and the remote bucket. Variant directories are listed with full
+// pagination, and deletes are fanned out across concurrent batched calls.
+func purgeImage(src *Source, name string) error {
+	imgDir, imgName := path.Split(name)
+
+	// Fetch list of directories in image path and append image name to each directory.
+	dirList, err := src.ListDirs(imgDir)
+	if err != nil {
+		return err
+	}
+
+	dirList = append(dirList, imgDir)
+	for i := range dirList {
+		dirList[i] = path.Join(dirList[i], imgName)
+	}
+
+	// Delete images from local and remote cache.
+	return src.Delete(dirList...)
+}
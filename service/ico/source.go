@@ -2,10 +2,21 @@ package ico
 
 import (
 	// Standard library
+	"bytes"
+	"container/list"
+	"crypto/sha256"
+	"encoding/hex"
 	"fmt"
+	"io"
+	"io/ioutil"
+	"net/http"
 	"os"
 	"path"
+	"runtime"
+	"strconv"
 	"strings"
+	"sync"
+	"syscall"
 	"time"
 
 	// Internal packages
@@ -16,11 +27,124 @@ import (
 	"github.com/goamz/goamz/s3"
 )
 
+// Used for applying transport options once, before the first S3 connection is made.
+var transportSetup sync.Once
+
+// SetupTransport tunes the shared HTTP transport for S3 access: the number of idle connections
+// kept per host, the time idle connections are kept open, and the time to wait for response
+// headers. Zero values leave the corresponding Go default untouched. S3 requests are issued
+// through the default HTTP client, so tuning the default transport covers every bucket.
+func SetupTransport(maxIdle, keepAlive, timeout int64) {
+	transportSetup.Do(func() {
+		t, ok := http.DefaultTransport.(*http.Transport)
+		if !ok {
+			return
+		}
+
+		if maxIdle > 0 {
+			t.MaxIdleConnsPerHost = int(maxIdle)
+
+			// Raise the transport-wide idle limit to match, which would otherwise cap the
+			// per-host limit when multiple buckets are in use.
+			if t.MaxIdleConns > 0 && t.MaxIdleConns < int(maxIdle) {
+				t.MaxIdleConns = int(maxIdle)
+			}
+		}
+
+		if keepAlive > 0 {
+			t.IdleConnTimeout = time.Duration(keepAlive) * time.Second
+		}
+
+		if timeout > 0 {
+			t.ResponseHeaderTimeout = time.Duration(timeout) * time.Second
+		}
+	})
+}
+
 // A Source represents an image source, which is usually matched against a URL endpoint, and
 // provides options related to that endpoint.
 type Source struct {
 	bucket *s3.Bucket
 	cache  *FileCache
+	mem    *MemCache
+
+	hashes     *index     // An index of object keys to the content digest of their bytes.
+	variants   *index     // An index of content digest and parameters to first stored variant path.
+	dedupeLock sync.Mutex // Used for controlling concurrent access to the dedupe indexes.
+}
+
+// The largest number of records kept in each dedupe index. Records are evicted in least recently
+// used order past this bound, so long-running processes serving a wide key space do not grow
+// their dedupe book-keeping without limit. Evicted records only cost the deduplication of future
+// renders, as every stored variant remains addressable under its own path.
+const dedupeIndexSize = 1 << 16
+
+// An index is a bounded map of string keys to string values, evicting its least recently used
+// record once grown past capacity. Access is assumed to be controlled by the owning lock.
+type index struct {
+	order *list.List               // A doubly-linked list of records, ordered by access time.
+	table map[string]*list.Element // A reverse lookup table of record keys to list elements.
+}
+
+// A record held in an index, pairing a key with its value.
+type record struct {
+	key   string
+	value string
+}
+
+// Initializes an empty index.
+func newIndex() *index {
+	return &index{order: list.New(), table: make(map[string]*list.Element)}
+}
+
+// Returns the value stored under `key`, marking the record as recently used. The boolean returned
+// is false if no record exists under `key`.
+func (x *index) get(key string) (string, bool) {
+	el, exists := x.table[key]
+	if !exists {
+		return "", false
+	}
+
+	x.order.MoveToFront(el)
+	return el.Value.(*record).value, true
+}
+
+// Stores `value` under `key`, evicting the least recently used record if the index has grown
+// beyond bounds.
+func (x *index) put(key, value string) {
+	if el, exists := x.table[key]; exists {
+		el.Value.(*record).value = value
+		x.order.MoveToFront(el)
+		return
+	}
+
+	x.table[key] = x.order.PushFront(&record{key, value})
+
+	if x.order.Len() > dedupeIndexSize {
+		el := x.order.Back()
+		delete(x.table, el.Value.(*record).key)
+		x.order.Remove(el)
+	}
+}
+
+// Drops the record stored under `key`, if any exists.
+func (x *index) remove(key string) {
+	if el, exists := x.table[key]; exists {
+		delete(x.table, key)
+		x.order.Remove(el)
+	}
+}
+
+// Drops all records whose value appears in the set provided.
+func (x *index) removeValues(drop map[string]bool) {
+	var next *list.Element
+	for el := x.order.Front(); el != nil; el = next {
+		next = el.Next()
+		if r := el.Value.(*record); drop[r.value] {
+			delete(x.table, r.key)
+			x.order.Remove(el)
+		}
+	}
 }
 
 // NewSource initializes a new source for region and bucket. Access is either provided by access and
@@ -38,14 +162,17 @@ func NewSource(region, bucket, accessKey, secretKey string) (*Source, error) {
 	}
 
 	s := &Source{
-		bucket: s3.New(auth, aws.Regions[region]).Bucket(bucket),
+		bucket:   s3.New(auth, aws.Regions[region]).Bucket(bucket),
+		hashes:   newIndex(),
+		variants: newIndex(),
 	}
 
 	return s, nil
 }
 
-// InitCache initializes and attaches local cache to source.
-func (s *Source) InitCache(base string, size int64) error {
+// InitCache initializes and attaches local caches to source: a disk-based cache of `size` bytes,
+// and, if `memory` is greater than zero, an in-memory hot tier of `memory` bytes layered above it.
+func (s *Source) InitCache(base string, size, memory int64) error {
 	base = path.Join(os.TempDir(), base, s.bucket.Region.Name, s.bucket.Name)
 
 	c, err := NewFileCache(base, size)
@@ -54,20 +181,63 @@ func (s *Source) InitCache(base string, size int64) error {
 	}
 
 	s.cache = c
+
+	if memory > 0 {
+		s.mem = NewMemCache(memory)
+	}
+
 	return nil
 }
 
-// Get fetches image data from local cache or S3 bucket for this source.
+// Get fetches image data from the in-memory tier, local cache or S3 bucket for this source, in
+// that order. Disk and remote hits are promoted into the in-memory tier for future requests.
 func (s *Source) Get(name string) (*image.Image, error) {
-	// Check for locally cached data.
+	// Check for data resident in memory.
+	if s.mem != nil {
+		if data := s.mem.Get(name); data != nil {
+			s.remember(name, data.([]byte))
+			return image.New(data.([]byte))
+		}
+	}
+
+	// Check for locally cached data. Cached files are served as read-only memory mappings backed
+	// by the kernel page cache, so no copy of the data passes through the heap; the mapping is
+	// released once the image is no longer referenced. Mapping failures fall back to a plain read.
 	if s.cache != nil {
+		if data := s.cache.Map(name); data != nil {
+			if s.mem != nil {
+				s.mem.Add(name, data)
+			}
+
+			s.remember(name, data)
+
+			img, err := image.New(data)
+			if err != nil {
+				syscall.Munmap(data)
+				return nil, err
+			}
+
+			img.Free = func() { syscall.Munmap(data) }
+			runtime.SetFinalizer(img, (*image.Image).Release)
+
+			return img, nil
+		}
+
 		if data := s.cache.Get(name); data != nil {
+			if s.mem != nil {
+				s.mem.Add(name, data)
+			}
+
+			s.remember(name, data.([]byte))
 			return image.New(data.([]byte))
 		}
 	}
 
-	// Get data from S3 bucket.
-	data, err := s.bucket.Get(name)
+	// Get data from S3 bucket, recording time spent fetching.
+	start := time.Now()
+	data, err := s.get(name)
+	metrics.fetch.Observe(time.Since(start))
+
 	if err != nil {
 		return nil, err
 	}
@@ -77,9 +247,269 @@ func (s *Source) Get(name string) (*image.Image, error) {
 		s.cache.Add(name, data)
 	}
 
+	if s.mem != nil {
+		s.mem.Add(name, data)
+	}
+
+	s.remember(name, data)
 	return image.New(data)
 }
 
+// Returns a hexadecimal cryptographic digest for the data provided. The dedupe index serves one
+// key's stored variants for another key's bytes on a digest match, so unlike the FNV hash used
+// for entity tags, constructing a collision must be infeasible, lest an uploaded original poison
+// the variants served for another key.
+func digestData(data []byte) string {
+	sum := sha256.Sum256(data)
+	return hex.EncodeToString(sum[:])
+}
+
+// Records and returns the content digest for the object bytes provided, memoized per key so repeat
+// fetches of a cached object are not re-hashed.
+func (s *Source) remember(name string, data []byte) string {
+	s.dedupeLock.Lock()
+	if h, exists := s.hashes.get(name); exists {
+		s.dedupeLock.Unlock()
+		return h
+	}
+	s.dedupeLock.Unlock()
+
+	// Hash outside the lock, as hashing time grows with object size.
+	h := digestData(data)
+
+	s.dedupeLock.Lock()
+	s.hashes.put(name, h)
+	s.dedupeLock.Unlock()
+
+	return h
+}
+
+// Hash returns the content digest recorded for the object stored under `name`, or an empty string
+// if its bytes have not passed through this source yet.
+func (s *Source) Hash(name string) string {
+	s.dedupeLock.Lock()
+	defer s.dedupeLock.Unlock()
+
+	h, _ := s.hashes.get(name)
+	return h
+}
+
+// Variant returns the processed image previously recorded for the content hash and parameter list
+// provided, allowing identical originals stored under different keys to share a single render. The
+// boolean returned is false if no such variant is known.
+func (s *Source) Variant(hash, params string) (*image.Image, bool) {
+	s.dedupeLock.Lock()
+	name, exists := s.variants.get(hash + "/" + params)
+	s.dedupeLock.Unlock()
+
+	if !exists {
+		return nil, false
+	}
+
+	img, err := s.Get(name)
+	if err != nil {
+		return nil, false
+	}
+
+	return img, true
+}
+
+// AddVariant records the path a processed variant was stored under, keyed on the content hash of
+// its original and the canonical parameter list used to produce it.
+func (s *Source) AddVariant(hash, params, name string) {
+	s.dedupeLock.Lock()
+	defer s.dedupeLock.Unlock()
+
+	s.variants.put(hash+"/"+params, name)
+}
+
+// Stat returns the size and content type for the object stored under `name`, checking local cache
+// book-keeping before falling back to an S3 HEAD request. The boolean returned is false if the
+// object exists in neither. No object data is fetched in either case.
+func (s *Source) Stat(name string) (int64, string, bool) {
+	// Answer from the locally cached file's metadata, determining content type from the file's
+	// magic header, which only touches its leading bytes.
+	if s.cache != nil {
+		if p, _, exists := s.cache.Stat(name); exists {
+			fl, err := os.Open(p)
+			if err == nil {
+				defer fl.Close()
+
+				var ctype string
+				var hdr [2]byte
+
+				if _, err := fl.ReadAt(hdr[:], 0); err == nil {
+					if k, valid := image.Type(hdr[:]); valid {
+						ctype = k.String()
+					}
+				}
+
+				if info, err := fl.Stat(); err == nil {
+					return info.Size(), ctype, true
+				}
+			}
+		}
+	}
+
+	// Answer from the S3 object's metadata.
+	resp, err := s.bucket.Head(name, nil)
+	if err != nil {
+		return 0, "", false
+	}
+
+	return resp.ContentLength, resp.Header.Get("Content-Type"), true
+}
+
+// The number of leading bytes fetched for header-only probes, enough to cover the image header in
+// all but pathological cases.
+const headerSize = 64 << 10 // 64KB
+
+// GetHeader returns the leading bytes of the object stored under `name`, for use in header-only
+// metadata probes. Fully cached objects are returned as-is; otherwise a single ranged GET fetches
+// the object's head, which is not inserted into local caches, as it is incomplete.
+func (s *Source) GetHeader(name string) ([]byte, error) {
+	if s.mem != nil {
+		if data := s.mem.Get(name); data != nil {
+			return data.([]byte), nil
+		}
+	}
+
+	if s.cache != nil {
+		if data := s.cache.Get(name); data != nil {
+			return data.([]byte), nil
+		}
+	}
+
+	// Range boundaries are inclusive; objects smaller than the range are returned in full.
+	hdr := map[string][]string{
+		"Range": {fmt.Sprintf("bytes=0-%d", headerSize-1)},
+	}
+
+	resp, err := s.bucket.GetResponseWithHeaders(name, hdr)
+	if err != nil {
+		return nil, err
+	}
+
+	defer resp.Body.Close()
+	return ioutil.ReadAll(resp.Body)
+}
+
+// The size of each byte range objects are downloaded as, and the number of ranges fetched at any
+// one time. Objects no larger than a single range are served whole by the first response.
+const (
+	rangedSize    = 4 << 20 // 4MB
+	rangedWorkers = 4
+)
+
+// Returns the total object size reported in a Content-Range header of the form
+// "bytes first-last/total", or -1 if the header is absent or cannot be parsed.
+func contentRangeSize(value string) int64 {
+	i := strings.LastIndex(value, "/")
+	if i < 0 {
+		return -1
+	}
+
+	size, err := strconv.ParseInt(value[i+1:], 10, 64)
+	if err != nil {
+		return -1
+	}
+
+	return size
+}
+
+// Fetches object data from the S3 bucket for this source. The first byte range is requested
+// outright, with the object's total size read from the Content-Range response header, so small
+// objects land in a single round trip. Larger objects have their remaining ranges downloaded
+// concurrently and reassembled in order, so fetch time tracks the slowest range rather than
+// single-stream throughput.
+func (s *Source) get(name string) ([]byte, error) {
+	hdr := map[string][]string{
+		"Range": {fmt.Sprintf("bytes=0-%d", rangedSize-1)},
+	}
+
+	resp, err := s.bucket.GetResponseWithHeaders(name, hdr)
+	if err != nil {
+		return nil, err
+	}
+
+	defer resp.Body.Close()
+
+	// A server that does not honour the Range header answers with the full object body.
+	if resp.StatusCode != http.StatusPartialContent {
+		return ioutil.ReadAll(resp.Body)
+	}
+
+	// Read the total object size from the Content-Range header, falling back to a plain GET for
+	// the rare response it cannot be determined from.
+	size := contentRangeSize(resp.Header.Get("Content-Range"))
+	if size < 0 {
+		return s.bucket.Get(name)
+	}
+
+	first := size
+	if first > rangedSize {
+		first = rangedSize
+	}
+
+	data := make([]byte, size)
+	if _, err := io.ReadFull(resp.Body, data[:first]); err != nil {
+		return nil, err
+	}
+
+	if size <= rangedSize {
+		return data, nil
+	}
+
+	count := int((size - first + rangedSize - 1) / rangedSize)
+	errs := make(chan error, count)
+
+	var wg sync.WaitGroup
+	sem := make(chan struct{}, rangedWorkers)
+
+	for i := 0; i < count; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+
+			sem <- struct{}{}
+			defer func() { <-sem }()
+
+			off := first + int64(i)*rangedSize
+			end := off + rangedSize
+			if end > size {
+				end = size
+			}
+
+			// Range boundaries are inclusive.
+			hdr := map[string][]string{
+				"Range": {fmt.Sprintf("bytes=%d-%d", off, end-1)},
+			}
+
+			resp, err := s.bucket.GetResponseWithHeaders(name, hdr)
+			if err != nil {
+				errs <- err
+				return
+			}
+
+			defer resp.Body.Close()
+
+			if _, err := io.ReadFull(resp.Body, data[off:end]); err != nil {
+				errs <- err
+			}
+		}(i)
+	}
+
+	wg.Wait()
+
+	select {
+	case err := <-errs:
+		return nil, err
+	default:
+	}
+
+	return data, nil
+}
+
 // Put inserts data into local cache and remote S3 bucket for this source.
 func (s *Source) Put(name string, data []byte, ctype string) error {
 	// Store data locally.
@@ -87,54 +517,186 @@ func (s *Source) Put(name string, data []byte, ctype string) error {
 		s.cache.Add(name, data)
 	}
 
-	// Store data in S3 bucket. The initial upload is placed with a `.tmp` prefix, and is renamed
-	// after it has uploaded successfully.
-	if err := s.bucket.Put(name+".tmp", data, ctype, "", s3.Options{}); err != nil {
-		return err
+	if s.mem != nil {
+		s.mem.Add(name, data)
+	}
+
+	// Store data in S3 bucket with a single PUT, which S3 guarantees to be atomic for a key.
+	// Large objects are uploaded as multiple concurrent parts instead, so upload time tracks the
+	// slowest part rather than the sum.
+	if int64(len(data)) >= multipartThreshold {
+		return s.putMulti(name, data, ctype)
 	}
 
-	src := path.Join(s.bucket.Name, name+".tmp")
-	if _, err := s.bucket.PutCopy(name, "", s3.CopyOptions{}, src); err != nil {
+	return s.bucket.Put(name, data, ctype, "", s3.Options{})
+}
+
+// The size above which uploads are split into concurrently-uploaded parts, the size of each part,
+// and the number of parts uploaded at any one time.
+const (
+	multipartThreshold = 16 << 20 // 16MB
+	multipartSize      = 8 << 20  // 8MB
+	multipartWorkers   = 4
+)
+
+// Uploads data as an S3 multipart object, pushing parts concurrently and completing the upload
+// once all parts have landed. The upload is aborted if any part fails.
+func (s *Source) putMulti(name string, data []byte, ctype string) error {
+	multi, err := s.bucket.InitMulti(strings.TrimPrefix(name, "/"), ctype, "")
+	if err != nil {
 		return err
 	}
 
-	s.bucket.Del(name + ".tmp")
+	count := (len(data) + multipartSize - 1) / multipartSize
+	parts := make([]s3.Part, count)
+	errs := make(chan error, count)
 
-	return nil
+	var wg sync.WaitGroup
+	sem := make(chan struct{}, multipartWorkers)
+
+	for i := 0; i < count; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+
+			sem <- struct{}{}
+			defer func() { <-sem }()
+
+			off := i * multipartSize
+			end := off + multipartSize
+			if end > len(data) {
+				end = len(data)
+			}
+
+			// Part numbers are one-based.
+			p, err := multi.PutPart(i+1, bytes.NewReader(data[off:end]))
+			if err != nil {
+				errs <- err
+				return
+			}
+
+			parts[i] = p
+		}(i)
+	}
+
+	wg.Wait()
+
+	select {
+	case err := <-errs:
+		multi.Abort()
+		return err
+	default:
+	}
+
+	return multi.Complete(parts)
 }
 
 // Delete removes one or more files from local cache and S3 bucket for this source.
 func (s *Source) Delete(name ...string) error {
-	// Delete from local cache.
-	if s.cache != nil {
-		for _, p := range name {
+	// Delete from local caches.
+	for _, p := range name {
+		if s.cache != nil {
 			s.cache.Remove(p)
 		}
+
+		if s.mem != nil {
+			s.mem.Remove(p)
+		}
+	}
+
+	// Drop dedupe records referring to the deleted objects, so purged variants cannot be
+	// resurrected through the dedupe index.
+	s.dedupeLock.Lock()
+	drop := make(map[string]bool, len(name))
+	for _, p := range name {
+		drop[p] = true
+		s.hashes.remove(p)
 	}
 
-	// Build objects list and delete from S3.
+	s.variants.removeValues(drop)
+	s.dedupeLock.Unlock()
+
+	// Build objects list and delete from S3 as concurrent batched calls, each within the S3
+	// per-request limit, so bulk purge time tracks the slowest batch rather than the sum.
 	objects := make([]s3.Object, len(name))
 	for i := range objects {
 		objects[i].Key = strings.TrimPrefix(name[i], "/")
 	}
 
-	if err := s.bucket.DelMulti(s3.Delete{true, objects}); err != nil {
+	count := (len(objects) + deleteBatch - 1) / deleteBatch
+	errs := make(chan error, count)
+
+	var wg sync.WaitGroup
+	sem := make(chan struct{}, deleteWorkers)
+
+	for i := 0; i < count; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+
+			sem <- struct{}{}
+			defer func() { <-sem }()
+
+			off := i * deleteBatch
+			end := off + deleteBatch
+			if end > len(objects) {
+				end = len(objects)
+			}
+
+			if err := s.bucket.DelMulti(s3.Delete{true, objects[off:end]}); err != nil {
+				errs <- err
+			}
+		}(i)
+	}
+
+	wg.Wait()
+
+	select {
+	case err := <-errs:
 		return err
+	default:
 	}
 
 	return nil
 }
 
-// ListDirs returns the full paths to any directories contained in path name.
+// The largest number of objects S3 accepts in a single multi-object delete, and the number of
+// delete batches issued at any one time.
+const (
+	deleteBatch   = 1000
+	deleteWorkers = 4
+)
+
+// ListDirs returns the full paths to any directories contained in path name, following result
+// pagination until the listing is exhausted.
 func (s *Source) ListDirs(name string) ([]string, error) {
-	resp, err := s.bucket.List(strings.TrimPrefix(name, "/"), "/", "", 0)
-	if err != nil {
-		return nil, err
-	}
+	var dirs []string
+	var marker string
+
+	for {
+		resp, err := s.bucket.List(strings.TrimPrefix(name, "/"), "/", marker, 0)
+		if err != nil {
+			return nil, err
+		}
+
+		for i := range resp.CommonPrefixes {
+			dirs = append(dirs, "/"+resp.CommonPrefixes[i])
+		}
+
+		if !resp.IsTruncated {
+			break
+		}
 
-	dirs := make([]string, len(resp.CommonPrefixes))
-	for i := range resp.CommonPrefixes {
-		dirs[i] = "/" + resp.CommonPrefixes[i]
+		// Delimited listings report the marker to resume from; plain listings resume after the
+		// last key returned.
+		marker = resp.NextMarker
+		if marker == "" && len(resp.Contents) > 0 {
+			marker = resp.Contents[len(resp.Contents)-1].Key
+		}
+
+		if marker == "" {
+			break
+		}
 	}
 
 	return dirs, nil
@@ -0,0 +1,131 @@
+package ico
+
+import (
+	// Standard library
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	// Internal packages
+	"github.com/deuill/mash/service/ico/image"
+)
+
+// Sizing and retry behaviour for the background upload queue. Failed uploads are retried with
+// exponential backoff starting at the base delay, before being counted as dropped.
+const (
+	uploadWorkers = 4
+	uploadQueue   = 256
+	uploadRetries = 5
+	uploadBackoff = 250 * time.Millisecond
+)
+
+// An upload represents a pending background store of a processed image. The image is retained
+// whole, as its data buffer is owned by the pipeline and released when the image is collected.
+type upload struct {
+	src  *Source
+	name string
+	img  *image.Image
+}
+
+// Uploader implements a bounded background queue for storing processed images to S3, replacing
+// unbounded fire-and-forget goroutines. Uploads are performed by a fixed worker pool, retried
+// with backoff on failure, and duplicate keys are coalesced while queued or in flight.
+type Uploader struct {
+	queue   chan *upload
+	pending map[string]bool // Keys queued or in flight, used for coalescing duplicates.
+
+	dropped int64 // The number of uploads dropped after exhausting retries, or on a full queue.
+
+	sync.Mutex // Used for controlling concurrent access to the pending table.
+}
+
+// NewUploader initializes a background uploader along with its worker pool.
+func NewUploader() *Uploader {
+	u := &Uploader{
+		queue:   make(chan *upload, uploadQueue),
+		pending: make(map[string]bool),
+	}
+
+	for i := 0; i < uploadWorkers; i++ {
+		go u.worker()
+	}
+
+	return u
+}
+
+// Enqueue schedules the image provided for upload under the given name. Duplicate keys already
+// queued or in flight are coalesced, and uploads are dropped, and counted as such, if the queue
+// is full; the local cache retains the data either way, so a dropped upload costs a re-render on
+// another node at worst.
+func (u *Uploader) Enqueue(src *Source, name string, img *image.Image) {
+	// Store data in local caches immediately, so identical requests arriving before the upload
+	// completes are served locally rather than re-rendered.
+	if src.cache != nil {
+		src.cache.Add(name, img.Data)
+	}
+
+	if src.mem != nil {
+		src.mem.Add(name, img.Data)
+	}
+
+	key := src.bucket.Region.Name + "/" + src.bucket.Name + name
+
+	u.Lock()
+	if u.pending[key] {
+		u.Unlock()
+		return
+	}
+
+	u.pending[key] = true
+	u.Unlock()
+
+	select {
+	case u.queue <- &upload{src: src, name: name, img: img}:
+	default:
+		u.forget(key)
+		atomic.AddInt64(&u.dropped, 1)
+	}
+}
+
+// Depth returns the number of uploads currently queued, and Dropped the total number of uploads
+// dropped since startup, for use in monitoring.
+func (u *Uploader) Depth() int64 {
+	return int64(len(u.queue))
+}
+
+func (u *Uploader) Dropped() int64 {
+	return atomic.LoadInt64(&u.dropped)
+}
+
+// Removes a key from the pending table, allowing future uploads for the same key to be queued.
+func (u *Uploader) forget(key string) {
+	u.Lock()
+	delete(u.pending, key)
+	u.Unlock()
+}
+
+// Consumes and performs uploads from the queue, retrying failed uploads with exponential backoff
+// before counting them as dropped.
+func (u *Uploader) worker() {
+	for up := range u.queue {
+		var err error
+
+		for i := 0; i < uploadRetries; i++ {
+			if err = up.src.Put(up.name, up.img.Data, up.img.Type.String()); err == nil {
+				break
+			}
+
+			time.Sleep(uploadBackoff << uint(i))
+		}
+
+		if err != nil {
+			atomic.AddInt64(&u.dropped, 1)
+		}
+
+		key := up.src.bucket.Region.Name + "/" + up.src.bucket.Name + up.name
+		u.forget(key)
+
+		runtime.KeepAlive(up.img)
+	}
+}